@@ -0,0 +1,442 @@
+/* mlbr - extract .lbr archives and decompress Squeeze, Crunch (v1 & v2)
+ *        and Cr-Lzh(v1 & v2) files.
+ *	Comments and date stamps are supported as is conversion to .zip file
+ *	Copyright (C) - 2020-2023 Mark Ogden
+ *
+ * crc.c - crc and checksum calculations
+ *
+ * NOTE: Elements of the code have been derived from public shared
+ * source code and documentation.
+ * The source files note the owning copyright holders where known
+ * 
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "mlbr.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define HAVE_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TARGET(isa)
+#else
+#include <cpuid.h>
+#define TARGET(isa) __attribute__((target(isa)))
+#endif
+#endif
+
+/*
+    crc16 is the CCITT / XMODEM crc used by lbr directories, crunch and cr-lzh
+    three implementations are provided
+    crc16Byte   the original one byte at a time table version, used as the reference
+    crc16Slice8 eight bytes at a time using eight tables
+    crc16Clmul  folds 16 byte blocks using carry-less multiply, x86 only
+    crc is the simple additive checksum used by squeeze and some crunch / cr-lzh files
+    sumByte     the original one byte at a time version, used as the reference
+    sumSse2     16 bytes at a time using PSADBW, x86 only
+    sumAvx2     32 bytes at a time using VPSADBW, x86 only
+    crc32 is the reflected zip / zlib crc used when writing .zip files
+    crc32Byte   the original miniz four bits at a time version, used as the reference
+    crc32Slice8 eight bytes at a time using eight tables
+    crc32Clmul  folds 16 byte blocks using carry-less multiply, x86 only
+    initCrc picks the fastest of each that the cpu supports and that passes a self-test
+    against the reference version. Until initCrc is called the reference versions are used
+*/
+static uint16_t const crcLookup[256] = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7, 0x8108, 0x9129, 0xA14A,
+    0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF, 0x1231, 0x0210, 0x3273, 0x2252, 0x52B5, 0x4294,
+    0x72F7, 0x62D6, 0x9339, 0x8318, 0xB37B, 0xA35A, 0xD3BD, 0xC39C, 0xF3FF, 0xE3DE, 0x2462,
+    0x3443, 0x0420, 0x1401, 0x64E6, 0x74C7, 0x44A4, 0x5485, 0xA56A, 0xB54B, 0x8528, 0x9509,
+    0xE5EE, 0xF5CF, 0xC5AC, 0xD58D, 0x3653, 0x2672, 0x1611, 0x0630, 0x76D7, 0x66F6, 0x5695,
+    0x46B4, 0xB75B, 0xA77A, 0x9719, 0x8738, 0xF7DF, 0xE7FE, 0xD79D, 0xC7BC, 0x48C4, 0x58E5,
+    0x6886, 0x78A7, 0x0840, 0x1861, 0x2802, 0x3823, 0xC9CC, 0xD9ED, 0xE98E, 0xF9AF, 0x8948,
+    0x9969, 0xA90A, 0xB92B, 0x5AF5, 0x4AD4, 0x7AB7, 0x6A96, 0x1A71, 0x0A50, 0x3A33, 0x2A12,
+    0xDBFD, 0xCBDC, 0xFBBF, 0xEB9E, 0x9B79, 0x8B58, 0xBB3B, 0xAB1A, 0x6CA6, 0x7C87, 0x4CE4,
+    0x5CC5, 0x2C22, 0x3C03, 0x0C60, 0x1C41, 0xEDAE, 0xFD8F, 0xCDEC, 0xDDCD, 0xAD2A, 0xBD0B,
+    0x8D68, 0x9D49, 0x7E97, 0x6EB6, 0x5ED5, 0x4EF4, 0x3E13, 0x2E32, 0x1E51, 0x0E70, 0xFF9F,
+    0xEFBE, 0xDFDD, 0xCFFC, 0xBF1B, 0xAF3A, 0x9F59, 0x8F78, 0x9188, 0x81A9, 0xB1CA, 0xA1EB,
+    0xD10C, 0xC12D, 0xF14E, 0xE16F, 0x1080, 0x00A1, 0x30C2, 0x20E3, 0x5004, 0x4025, 0x7046,
+    0x6067, 0x83B9, 0x9398, 0xA3FB, 0xB3DA, 0xC33D, 0xD31C, 0xE37F, 0xF35E, 0x02B1, 0x1290,
+    0x22F3, 0x32D2, 0x4235, 0x5214, 0x6277, 0x7256, 0xB5EA, 0xA5CB, 0x95A8, 0x8589, 0xF56E,
+    0xE54F, 0xD52C, 0xC50D, 0x34E2, 0x24C3, 0x14A0, 0x0481, 0x7466, 0x6447, 0x5424, 0x4405,
+    0xA7DB, 0xB7FA, 0x8799, 0x97B8, 0xE75F, 0xF77E, 0xC71D, 0xD73C, 0x26D3, 0x36F2, 0x0691,
+    0x16B0, 0x6657, 0x7676, 0x4615, 0x5634, 0xD94C, 0xC96D, 0xF90E, 0xE92F, 0x99C8, 0x89E9,
+    0xB98A, 0xA9AB, 0x5844, 0x4865, 0x7806, 0x6827, 0x18C0, 0x08E1, 0x3882, 0x28A3, 0xCB7D,
+    0xDB5C, 0xEB3F, 0xFB1E, 0x8BF9, 0x9BD8, 0xABBB, 0xBB9A, 0x4A75, 0x5A54, 0x6A37, 0x7A16,
+    0x0AF1, 0x1AD0, 0x2AB3, 0x3A92, 0xFD2E, 0xED0F, 0xDD6C, 0xCD4D, 0xBDAA, 0xAD8B, 0x9DE8,
+    0x8DC9, 0x7C26, 0x6C07, 0x5C64, 0x4C45, 0x3CA2, 0x2C83, 0x1CE0, 0x0CC1, 0xEF1F, 0xFF3E,
+    0xCF5D, 0xDF7C, 0xAF9B, 0xBFBA, 0x8FD9, 0x9FF8, 0x6E17, 0x7E36, 0x4E55, 0x5E74, 0x2E93,
+    0x3EB2, 0x0ED1, 0x1EF0,
+};
+
+static uint16_t crc16Tables[8][256]; // [n][c] is the crc of byte c followed by n zero bytes
+
+static uint16_t crc16Byte(uint16_t crc, uint8_t const *data, long len) {
+    while (len-- > 0) {
+        crc = (crc << 8) ^ crcLookup[(crc >> 8) ^ *data++];
+    }
+    return crc;
+}
+
+static uint16_t crc16Slice8(uint16_t crc, uint8_t const *data, long len) {
+    uint16_t const(*t)[256] = crc16Tables;
+
+    for (; len >= 8; len -= 8, data += 8) {
+        crc = t[7][(crc >> 8) ^ data[0]] ^ t[6][(crc & 0xff) ^ data[1]] ^ t[5][data[2]] ^
+              t[4][data[3]] ^ t[3][data[4]] ^ t[2][data[5]] ^ t[1][data[6]] ^ t[0][data[7]];
+    }
+    while (len-- > 0) {
+        crc = (crc << 8) ^ t[0][(crc >> 8) ^ *data++];
+    }
+    return crc;
+}
+
+// the crc32 engines work on the inverted crc, the inversions are done by crc32Update
+static uint32_t const crc32Lookup[16] = {
+    0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+    0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c, 0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c,
+};
+
+static uint32_t crc32Tables[8][256]; // [n][c] is the crc of byte c followed by n zero bytes
+
+static uint32_t crc32Byte(uint32_t crc, uint8_t const *data, long len) {
+    while (len-- > 0) {
+        crc = (crc >> 4) ^ crc32Lookup[(crc & 0xf) ^ (*data & 0xf)];
+        crc = (crc >> 4) ^ crc32Lookup[(crc & 0xf) ^ (*data++ >> 4)];
+    }
+    return crc;
+}
+
+static uint32_t crc32Slice8(uint32_t crc, uint8_t const *data, long len) {
+    uint32_t const(*t)[256] = crc32Tables;
+
+    for (; len >= 8; len -= 8, data += 8) {
+        crc ^= data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+        crc = t[7][crc & 0xff] ^ t[6][(crc >> 8) & 0xff] ^ t[5][(crc >> 16) & 0xff] ^
+              t[4][crc >> 24] ^ t[3][data[4]] ^ t[2][data[5]] ^ t[1][data[6]] ^ t[0][data[7]];
+    }
+    while (len-- > 0) {
+        crc = (crc >> 8) ^ t[0][(crc ^ *data++) & 0xff];
+    }
+    return crc;
+}
+
+#ifdef HAVE_X86
+/*
+    the data is processed as 128 bit big endian blocks. A block at position n is
+    equivalent modulo the polynomial to one at position n + 1 multiplied by x^128
+    so the running value is folded forward by splitting it into two 64 bit halves
+    and multiplying by x^192 mod P and x^128 mod P. Four blocks are folded in
+    parallel, using x^576 and x^512 to step 64 bytes. The final 128 bit value has
+    the same crc as the data so far and is reduced using crc16Slice8
+*/
+#define BYTESWAP _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15)
+
+TARGET("pclmul,ssse3")
+static inline __m128i fold16(__m128i x, __m128i k, __m128i next) {
+    __m128i hi = _mm_clmulepi64_si128(x, k, 0x11);
+    __m128i lo = _mm_clmulepi64_si128(x, k, 0x00);
+    return _mm_xor_si128(_mm_xor_si128(hi, lo), next);
+}
+
+TARGET("pclmul,ssse3")
+static inline __m128i loadBlock(uint8_t const *data) {
+    return _mm_shuffle_epi8(_mm_loadu_si128((__m128i const *)data), BYTESWAP);
+}
+
+TARGET("pclmul,ssse3")
+static uint16_t crc16Clmul(uint16_t crc, uint8_t const *data, long len) {
+    if (len < 64) {
+        return crc16Slice8(crc, data, len);
+    }
+    __m128i const k64 = _mm_set_epi64x(0x8832, 0x13fc); // x^576, x^512 mod P
+    __m128i const k16 = _mm_set_epi64x(0x650b, 0xaefc); // x^192, x^128 mod P
+    __m128i x[4];
+
+    for (int i = 0; i < 4; i++) {
+        x[i] = loadBlock(data + i * 16);
+    }
+    x[0] = _mm_xor_si128(x[0], _mm_set_epi64x((long long)((uint64_t)crc << 48), 0)); // initial crc
+    for (data += 64, len -= 64; len >= 64; data += 64, len -= 64) {
+        for (int i = 0; i < 4; i++) {
+            x[i] = fold16(x[i], k64, loadBlock(data + i * 16));
+        }
+    }
+    __m128i r = x[0];
+    for (int i = 1; i < 4; i++) {
+        r = fold16(r, k16, x[i]);
+    }
+    for (; len >= 16; data += 16, len -= 16) {
+        r = fold16(r, k16, loadBlock(data));
+    }
+
+    uint8_t block[16];
+    _mm_storeu_si128((__m128i *)block, _mm_shuffle_epi8(r, BYTESWAP));
+    return crc16Slice8(crc16Slice8(0, block, 16), data, len);
+}
+
+/*
+    crc32 is bit reflected so the blocks are used as loaded and the roles of the halves
+    swap, the constants are the reflected x^(n-32) mod P values shifted left one bit
+    to allow for the reflected product being one bit short
+*/
+TARGET("pclmul,ssse3")
+static uint32_t crc32Clmul(uint32_t crc, uint8_t const *data, long len) {
+    if (len < 64) {
+        return crc32Slice8(crc, data, len);
+    }
+    __m128i const k64 = _mm_set_epi64x(0x01c6e41596, 0x0154442bd4);
+    __m128i const k16 = _mm_set_epi64x(0x00ccaa009e, 0x01751997d0);
+    __m128i x[4];
+
+    for (int i = 0; i < 4; i++) {
+        x[i] = _mm_loadu_si128((__m128i const *)(data + i * 16));
+    }
+    x[0] = _mm_xor_si128(x[0], _mm_cvtsi32_si128((int)crc)); // initial crc
+    for (data += 64, len -= 64; len >= 64; data += 64, len -= 64) {
+        for (int i = 0; i < 4; i++) {
+            x[i] = fold16(x[i], k64, _mm_loadu_si128((__m128i const *)(data + i * 16)));
+        }
+    }
+    __m128i r = x[0];
+    for (int i = 1; i < 4; i++) {
+        r = fold16(r, k16, x[i]);
+    }
+    for (; len >= 16; data += 16, len -= 16) {
+        r = fold16(r, k16, _mm_loadu_si128((__m128i const *)data));
+    }
+
+    uint8_t block[16];
+    _mm_storeu_si128((__m128i *)block, r);
+    return crc32Slice8(crc32Slice8(0, block, 16), data, len);
+}
+
+#endif
+
+static uint16_t sumByte(uint16_t sum, uint8_t const *data, long len) {
+    while (len-- > 0) {
+        sum += *data++;
+    }
+    return sum;
+}
+
+#ifdef HAVE_X86
+// PSADBW sums each group of 8 bytes into a 64 bit lane, only the low 16 bits of the total matter
+TARGET("sse2")
+static uint16_t sumSse2(uint16_t sum, uint8_t const *data, long len) {
+    __m128i const zero = _mm_setzero_si128();
+    __m128i acc        = zero;
+
+    for (; len >= 16; data += 16, len -= 16) {
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_loadu_si128((__m128i const *)data), zero));
+    }
+    acc = _mm_add_epi64(acc, _mm_unpackhi_epi64(acc, acc));
+    return sumByte(sum + (uint16_t)_mm_cvtsi128_si32(acc), data, len);
+}
+
+TARGET("avx2")
+static uint16_t sumAvx2(uint16_t sum, uint8_t const *data, long len) {
+    __m256i const zero = _mm256_setzero_si256();
+    __m256i acc0       = zero;
+    __m256i acc1       = zero;
+
+    for (; len >= 64; data += 64, len -= 64) {
+        __m256i a = _mm256_loadu_si256((__m256i const *)data);
+        __m256i b = _mm256_loadu_si256((__m256i const *)(data + 32));
+        acc0      = _mm256_add_epi64(acc0, _mm256_sad_epu8(a, zero));
+        acc1      = _mm256_add_epi64(acc1, _mm256_sad_epu8(b, zero));
+    }
+    acc0        = _mm256_add_epi64(acc0, acc1);
+    __m128i acc = _mm_add_epi64(_mm256_castsi256_si128(acc0), _mm256_extracti128_si256(acc0, 1));
+    acc         = _mm_add_epi64(acc, _mm_unpackhi_epi64(acc, acc));
+    return sumSse2(sum + (uint16_t)_mm_cvtsi128_si32(acc), data, len);
+}
+
+static bool haveSse2() {
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 1);
+    return info[3] & (1 << 26);
+#else
+    unsigned eax, ebx, ecx, edx;
+    return __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (edx & bit_SSE2);
+#endif
+}
+
+static bool haveClmul() {
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 1)) && (info[2] & (1 << 9)); // PCLMULQDQ and SSSE3
+#else
+    unsigned eax, ebx, ecx, edx;
+    return __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_PCLMUL) && (ecx & bit_SSSE3);
+#endif
+}
+
+static bool haveAvx2() {
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 1);
+    if ((info[2] & (3 << 27)) != (3 << 27) || (_xgetbv(0) & 6) != 6) { // OSXSAVE, AVX & YMM state
+        return false;
+    }
+    __cpuidex(info, 7, 0);
+    return info[1] & (1 << 5);
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+typedef uint16_t (*engine_t)(uint16_t crc, uint8_t const *data, long len);
+typedef uint32_t (*engine32_t)(uint32_t crc, uint8_t const *data, long len);
+
+static engine_t crc16Engine   = crc16Byte;
+static engine_t sumEngine     = sumByte;
+static engine32_t crc32Engine = crc32Byte;
+
+#define TESTSIZE 1100
+static void testData(uint8_t *data) {
+    uint32_t seed = 1;
+    for (int i = 0; i < TESTSIZE; i++) {
+        seed    = seed * 1103515245 + 12345;
+        data[i] = (uint8_t)(seed >> 16);
+    }
+}
+
+// check an implementation against its reference for a range of lengths, alignments and start values
+static bool engineOk(engine_t engine, engine_t reference) {
+    uint8_t data[TESTSIZE];
+    testData(data);
+    for (long len = 0; len <= 1024; len += len < 200 ? 1 : 37) {
+        for (int align = 0; align < 8; align++) {
+            uint16_t crc = (uint16_t)(len * 0x9e37 + align);
+            if (engine(crc, data + align, len) != reference(crc, data + align, len)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static bool engine32Ok(engine32_t engine, engine32_t reference) {
+    uint8_t data[TESTSIZE];
+    testData(data);
+    for (long len = 0; len <= 1024; len += len < 200 ? 1 : 37) {
+        for (int align = 0; align < 8; align++) {
+            uint32_t crc = (uint32_t)(len * 0x9e3779b9 + align);
+            if (engine(crc, data + align, len) != reference(crc, data + align, len)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// select the crc implementations, must be called before any threads are started
+void initCrc() {
+    for (int c = 0; c < 256; c++) {
+        crc16Tables[0][c] = crcLookup[c];
+        for (int n = 1; n < 8; n++) {
+            uint16_t prev     = crc16Tables[n - 1][c];
+            crc16Tables[n][c] = (prev << 8) ^ crcLookup[prev >> 8];
+        }
+    }
+    uint8_t const zero = 0;
+    for (int c = 0; c < 256; c++) {
+        crc32Tables[0][c] = crc32Byte(c, &zero, 1);
+    }
+    for (int c = 0; c < 256; c++) {
+        for (int n = 1; n < 8; n++) {
+            uint32_t prev     = crc32Tables[n - 1][c];
+            crc32Tables[n][c] = (prev >> 8) ^ crc32Tables[0][prev & 0xff];
+        }
+    }
+    if (engineOk(crc16Slice8, crc16Byte)) {
+        crc16Engine = crc16Slice8;
+    }
+    if (engine32Ok(crc32Slice8, crc32Byte)) {
+        crc32Engine = crc32Slice8;
+    }
+#ifdef HAVE_X86
+    if (haveClmul() && engineOk(crc16Clmul, crc16Byte)) {
+        crc16Engine = crc16Clmul;
+    }
+    if (haveClmul() && engine32Ok(crc32Clmul, crc32Byte)) {
+        crc32Engine = crc32Clmul;
+    }
+    if (haveSse2() && engineOk(sumSse2, sumByte)) {
+        sumEngine = sumSse2;
+    }
+    if (haveSse2() && haveAvx2() && engineOk(sumAvx2, sumByte)) {
+        sumEngine = sumAvx2;
+    }
+#endif
+}
+
+uint16_t crc16Update(uint16_t crc, uint8_t const *data, long len) {
+    return crc16Engine(crc, data, len);
+}
+
+uint16_t crc16(uint8_t const *data, long len) {
+    return crc16Update(0, data, len);
+}
+
+uint16_t crcUpdate(uint16_t crc, uint8_t const *data, long len) {
+    return sumEngine(crc, data, len);
+}
+
+uint16_t crc(uint8_t const *data, long len) {
+    return crcUpdate(0, data, len);
+}
+
+// zlib style crc32, the crc passed in and returned is the finished value, start with 0
+uint32_t crc32Update(uint32_t crc, uint8_t const *data, long len) {
+    return ~crc32Engine(~crc, data, len);
+}
+
+// x^n mod P for the reflected crc32 polynomial, used to combine crcs
+static uint32_t multModP(uint32_t a, uint32_t b) {
+    uint32_t m = 1U << 31;
+    uint32_t p = 0;
+    for (;;) {
+        if (a & m) {
+            p ^= b;
+            if ((a & (m - 1)) == 0) {
+                break;
+            }
+        }
+        m >>= 1;
+        b = b & 1 ? (b >> 1) ^ 0xedb88320 : b >> 1;
+    }
+    return p;
+}
+
+// crc32 of the concatenation of two blocks, given their crcs and the length of the second
+uint32_t crc32Combine(uint32_t crc1, uint32_t crc2, long len2) {
+    uint32_t xPow  = 1U << 23; // x^8, the shift for one byte, squared for each bit of len2
+    uint32_t shift = 1U << 31; // x^0
+    for (; len2 > 0; len2 >>= 1) {
+        if (len2 & 1) {
+            shift = multModP(xPow, shift);
+        }
+        xPow = multModP(xPow, xPow);
+    }
+    return multModP(shift, crc1) ^ crc2;
+}
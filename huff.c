@@ -29,21 +29,66 @@
 
 #define MAXNODE 256
 
-static struct { int child[2]; } node[MAXNODE + 1];
+/*
+    rather than walk the tree a bit at a time, the first LOOKUPBITS bits of a
+    code are used to index a table built from the tree. Each entry gives the
+    number of bits used and either the decoded value or, for longer codes, the
+    node reached, from which the tree walk continues
+*/
+#define LOOKUPBITS 10
+#define LOOKUPSIZE (1 << LOOKUPBITS)
 
-static int usqU8(content_t *content) {
-    int i;
+typedef struct {
+    int16_t val; // decoded value or node to continue from
+    uint8_t len; // bits used
+    bool leaf;   // val is a decoded value
+} lookup_t;
+
+// decoder context, one per call of unsqueeze so decodes can run concurrently
+typedef struct {
+    struct {
+        int child[2];
+    } node[MAXNODE + 1];
+    lookup_t lookup[LOOKUPSIZE];
+} usq_t;
+
+static void mkLookup(usq_t *usq) {
+    for (int code = 0; code < LOOKUPSIZE; code++) {
+        int i   = 0;
+        int len = 0;
+        while (len < LOOKUPBITS && i >= 0) {
+            i = usq->node[i].child[(code >> len++) & 1];
+        }
+        usq->lookup[code] = (lookup_t){ i < 0 ? -(i + 1) : i, len, i < 0 };
+    }
+}
+
+static int usqU8(usq_t *usq, content_t *content) {
+    int i = 0;
     int cbit;
 
-    for (i = 0; i >= 0 && (cbit = inBitRev(content)) >= 0;) {
-        i = node[i].child[cbit];
+    int code = peekBitsRev(content, LOOKUPBITS);
+    if (content->bitCount >= LOOKUPBITS) {
+        lookup_t const *entry = &usq->lookup[code];
+        skipBitsRev(content, entry->len);
+        if (entry->leaf) {
+            return entry->val == MAXNODE ? EOF : entry->val;
+        }
+        i = entry->val;
+    }
+    while (i >= 0) { // long code or near the end of the data
+        if ((cbit = inBitRev(content)) < 0) {
+            return EOF;
+        }
+        i = usq->node[i].child[cbit];
     }
 
     i = -(i + 1);
-    return (cbit < 0 || i == MAXNODE) ? EOF : i;
+    return i == MAXNODE ? EOF : i;
 }
 
 int unsqueeze(content_t *content) {
+    usq_t usq;
     int nodeCnt;
     int c;
 
@@ -56,22 +101,28 @@ int unsqueeze(content_t *content) {
         return BADHEADER;
     }
     // put in minimal node (EOF)
-    node[0].child[0] = node[0].child[1] = -(MAXNODE + 1);
+    usq.node[0].child[0] = usq.node[0].child[1] = -(MAXNODE + 1);
 
     for (int i = 0; i < nodeCnt; i++) {
-        node[i].child[0] = inI16(content);
-        node[i].child[1] = inI16(content); //-V656
+        for (int j = 0; j < 2; j++) {
+            int child = usq.node[i].child[j] = inI16(content);
+            if (child >= nodeCnt || child < -(MAXNODE + 1)) { // not a valid node or value
+                return CORRUPT;
+            }
+        }
     }
     if (isEof(content)) {
         return CORRUPT;
     }
+    mkLookup(&usq);
 
+    startCheck(content, CHK_SUM);
     outRle(-1, content); // reset engine
-    while ((c = usqU8(content)) != EOF) {
+    while ((c = usqU8(&usq, content)) != EOF) {
         outRle(c, content);
     }
 
     inSeek(content, 2); // locate the CRC
     /*verify checksum*/
-    return crc(content->out.buf, content->out.pos) == inU16(content); // returns BADCRC or GOOD
+    return endCheck(content) == inU16(content); // returns BADCRC or GOOD
 }
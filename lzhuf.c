@@ -49,8 +49,6 @@
 
 #define EOF_CODE  256
 
-static uint8_t text_buf[LZ_N + LZ_F - 1];
-
 /* Huffman coding parameters */
 #define N_CHAR   (256 + 1 - THRESHOLD + LZ_F)
 /* kinds of characters (character code = 0..N_CHAR-1) */
@@ -59,8 +57,6 @@ static uint8_t text_buf[LZ_N + LZ_F - 1];
 #define MAX_FREQ 0x8000           /* updates tree when the */
                                   /* root frequency comes to this value. */
 
-static uint8_t oldver;
-
 /*
  * Tables for decoding upper 6 bits of
  * sliding dictionary pointer
@@ -105,118 +101,124 @@ static uint8_t d_len[256] = {
     0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08,
 };
 
-static unsigned freq[LZ_T + 1]; /* cumulative freq table */
+// decoder context, one per call of uncrLzh so decodes can run concurrently
+typedef struct {
+    uint8_t text_buf[LZ_N + LZ_F - 1];
+    uint8_t oldver;
 
-/*
- * pointing parent nodes.
- * area [LZ_T..(LZ_T + N_CHAR - 1)] are pointers for leaves
- */
-static int prnt[LZ_T + N_CHAR];
+    unsigned freq[LZ_T + 1]; /* cumulative freq table */
+
+    /*
+     * pointing parent nodes.
+     * area [LZ_T..(LZ_T + N_CHAR - 1)] are pointers for leaves
+     */
+    int prnt[LZ_T + N_CHAR];
 
-/* pointing children nodes (son[], son[] + 1)*/
-static int son[LZ_T + 1]; // getcode could access son[LZ_T]
+    /* pointing children nodes (son[], son[] + 1)*/
+    int son[LZ_T + 1]; // getcode could access son[LZ_T]
+} lzh_t;
 
 /* initialize freq tree */
 
-static void startHuff() {
+static void startHuff(lzh_t *lz) {
 
     for (int i = 0; i < N_CHAR; i++) {
-        freq[i]        = 1;
-        son[i]         = i + LZ_T;
-        prnt[i + LZ_T] = i;
+        lz->freq[i]        = 1;
+        lz->son[i]         = i + LZ_T;
+        lz->prnt[i + LZ_T] = i;
     }
     for (int i = 0, j = N_CHAR; j <= LZ_R; i += 2, j++) {
-        freq[j] = freq[i] + freq[i + 1];
-        son[j]  = i;
-        prnt[i] = prnt[i + 1] = j;
+        lz->freq[j] = lz->freq[i] + lz->freq[i + 1];
+        lz->son[j]  = i;
+        lz->prnt[i] = lz->prnt[i + 1] = j;
     }
-    freq[LZ_T] = 0xffff;
-    prnt[LZ_R] = 0;
+    lz->freq[LZ_T] = 0xffff;
+    lz->prnt[LZ_R] = 0;
 }
 
 /* reconstruct freq tree */
 
-static void reconst() {
+static void reconst(lzh_t *lz) {
     /* halven cumulative freq for leaf nodes */
 
     for (int i = 0, j = 0; i < LZ_T; i++) {
-        if (son[i] >= LZ_T) {
-            freq[j] = (freq[i] + 1) / 2;
-            son[j]  = son[i];
+        if (lz->son[i] >= LZ_T) {
+            lz->freq[j] = (lz->freq[i] + 1) / 2;
+            lz->son[j]  = lz->son[i];
             j++;
         }
     }
     /* make a tree : first, connect children nodes */
     for (int i = 0, j = N_CHAR; j < LZ_T; i += 2, j++) {
-        unsigned f = freq[i] + freq[i + 1];
+        unsigned f = lz->freq[i] + lz->freq[i + 1];
         int k;
-        for (k = j; f < freq[k - 1]; k--) { // find insert point
-            freq[k] = freq[k - 1];          // by moving items up
-            son[k]  = son[k - 1];
+        for (k = j; f < lz->freq[k - 1]; k--) { // find insert point
+            lz->freq[k] = lz->freq[k - 1];          // by moving items up
+            lz->son[k]  = lz->son[k - 1];
         }
-        freq[k] = f; // insert
-        son[k]  = i;
+        lz->freq[k] = f; // insert
+        lz->son[k]  = i;
     }
     /* connect parent nodes */
     for (int i = 0; i < LZ_T; i++) {
         int k;
-        if ((k = son[i]) >= LZ_T) {
-            prnt[k] = i;
+        if ((k = lz->son[i]) >= LZ_T) {
+            lz->prnt[k] = i;
         } else {
-            prnt[k] = prnt[k + 1] = i;
+            lz->prnt[k] = lz->prnt[k + 1] = i;
         }
     }
 }
 
 /* update freq tree */
 
-static void update(unsigned c) {
+static void update(lzh_t *lz, unsigned c) {
     unsigned i;
     unsigned j;
     unsigned k;
     unsigned l;
 
-    if (freq[LZ_R] == MAX_FREQ) {
-        reconst();
+    if (lz->freq[LZ_R] == MAX_FREQ) {
+        reconst(lz);
     }
 
-    c = prnt[c + LZ_T];
+    c = lz->prnt[c + LZ_T];
     do {
-        k = ++freq[c];
+        k = ++lz->freq[c];
 
         /* swap nodes to keep the tree freq-ordered */
-        if (k > freq[l = c + 1]) {
-            while (k > freq[++l]) {
+        if (k > lz->freq[l = c + 1]) {
+            while (k > lz->freq[++l]) {
                 ;
             }
             l--;
-            freq[c] = freq[l];
-            freq[l] = k;
+            lz->freq[c] = lz->freq[l];
+            lz->freq[l] = k;
 
-            i       = son[c];
-            prnt[i] = l;
+            i           = lz->son[c];
+            lz->prnt[i] = l;
             if (i < LZ_T) {
-                prnt[i + 1] = l;
+                lz->prnt[i + 1] = l;
             }
 
-            j       = son[l];
-            son[l]  = i;
+            j           = lz->son[l];
+            lz->son[l]  = i;
 
-            prnt[j] = c;
+            lz->prnt[j] = c;
             if (j < LZ_T) {
-                prnt[j + 1] = c;
+                lz->prnt[j + 1] = c;
             }
-            son[c] = j;
+            lz->son[c] = j;
 
-            c      = l;
+            c          = l;
         }
-    } while ((c = prnt[c]) != 0); /* do it until reaching the root */
+    } while ((c = lz->prnt[c]) != 0); /* do it until reaching the root */
 }
 
-static unsigned DecodeChar(content_t *content) {
+static unsigned DecodeChar(lzh_t *lz, content_t *content) {
     unsigned c;
 
-    c = son[LZ_R];
+    c = lz->son[LZ_R];
 
     /*
      * start searching tree from the root to leaves.
@@ -224,14 +226,14 @@ static unsigned DecodeChar(content_t *content) {
      * else choose #(son[]+1) (input bit == 1)
      */
     while (c < LZ_T) {
-        c = son[c + (inBits(content, 1) > 0)]; // will map <= 0 to 0 else 1
+        c = lz->son[c + (inBits(content, 1) > 0)]; // will map <= 0 to 0 else 1
     }
     c -= LZ_T;
-    update(c);
+    update(lz, c);
     return c;
 }
 
-static unsigned DecodePosition(content_t *content) {
+static unsigned DecodePosition(lzh_t *lz, content_t *content) {
     int i;
     unsigned j;
     unsigned c;
@@ -241,15 +243,15 @@ static unsigned DecodePosition(content_t *content) {
         i = 0;
     }
 
-    c = d_code[i] << (5 + oldver); // 5 or 6 for 1.x
+    c = d_code[i] << (5 + lz->oldver); // 5 or 6 for 1.x
 
     /* input lower 6 bits directly */
-    j = d_len[i] - (3 - oldver); // 3 or 2 for 1.x
+    j = d_len[i] - (3 - lz->oldver); // 3 or 2 for 1.x
 
     while (j--) {
         i = (i << 1) + (inBits(content, 1) > 0);
     }
-    return c | (i & (oldver ? 0x3f : 0x1f)); // 0x1f or 0x3f for 1.x
+    return c | (i & (lz->oldver ? 0x3f : 0x1f)); // 0x1f or 0x3f for 1.x
 }
 
 int uncrLzh(content_t *content) { /* Decoding/Uncompressing */
@@ -276,31 +278,37 @@ int uncrLzh(content_t *content) { /* Decoding/Uncompressing */
         return BADHEADER;
     }
 
-    oldver        = siglevel < 0x20;
     content->type = siglevel < 0x20 ? CrLzhV1 : CrLzhV2;
 
-    startHuff();
+    lzh_t *lz     = xmalloc(sizeof(lzh_t)); // decoder tables are too big for the stack
+    lz->oldver    = siglevel < 0x20;
+
+    startHuff(lz);
     r = LZ_N - LZ_F;
-    memset(text_buf, ' ', r); //-V512
+    memset(lz->text_buf, ' ', r); //-V512
+    startCheck(content, errdetect == 1 ? CHK_CRC16 : errdetect == 0 ? CHK_SUM : CHK_NONE);
 
     // if we reach EOF then we don't have the CRC info
-    while ((c = DecodeChar(content)) != EOF_CODE &&
-           !isEof(content)) { // EOF or no more bytes (need 2 for CRC)
+    while ((c = DecodeChar(lz, content)) != EOF_CODE &&
+           bitsLeft(content) >= 8) { // EOF or no more bytes (need 2 for CRC)
         if (c < EOF_CODE) {
             outU8(c, content);
-            text_buf[r++] = c;
+            lz->text_buf[r++] = c;
             r %= LZ_N;
         } else {
-            i = (r - DecodePosition(content) - 1) % LZ_N;
+            i = (r - DecodePosition(lz, content) - 1) % LZ_N;
             j = c - EOF_CODE + THRESHOLD;
             for (k = 0; k < j; k++) {
-                c = text_buf[(i + k) % LZ_N];
+                c = lz->text_buf[(i + k) % LZ_N];
                 outU8(c, content);
-                text_buf[r++] = c;
+                lz->text_buf[r++] = c;
                 r %= LZ_N;
             }
         }
     }
+    xfree(lz);
+    endBits(content);
+
     /*verify checksum if required*/
     int fileCrc = inU16(content);
     if (fileCrc < 0) {
@@ -308,11 +316,8 @@ int uncrLzh(content_t *content) { /* Decoding/Uncompressing */
     }
 
     // tests below will return BADCRC or GOOD
-    if (errdetect == 1) {
-        return crc16(content->out.buf, content->out.pos) == fileCrc;
-    }
-    if (errdetect == 0) {
-        return crc(content->out.buf, content->out.pos) == fileCrc;
+    if (errdetect <= 1) { // crc16 or checksum
+        return endCheck(content) == fileCrc;
     }
     return GOOD;
 }
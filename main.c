@@ -34,7 +34,15 @@ bool ignoreCorrupt    = false;
 bool ignoreCrc        = false;
 bool srcDstSame       = false;
 int flags             = 0;
+int jobs              = 1;
+int lbrThreads        = 1; // threads used on the members of a library and its zip entries
 char const *targetDir = ".";
+char const *zipAll    = NULL; // -Z single zip file for all of the files
+char const *tarAll    = NULL; // -T single tar.gz file for all of the files
+bool update           = false; // -u update the -Z zip file
+bool asyncIo          = false; // -a batch the writes of extracted files
+bool streamOut        = false; // -s spill large decoded files to temporary files
+char const *spillDir  = ".";   // -s where the temporary files go, the target directory
 
 char *mapCase(char *s) {
     return keepCase ? s : strlwr(s);
@@ -90,10 +98,15 @@ int getMethod(content_t *content) {
     return Stored;
 }
 
+static int processMembers(content_t *head, int flags, int depth);
+
 // process a file / library
 // returns the number of non skipped / missing files available
 int processFile(content_t *content, int flags, int depth) {
     int result = 0;
+    chkLbrCrc(content);
+    // if nothing is saved only the check value of the output is needed
+    content->sink = !(flags & SAVEMASK) ? SINK_DISCARD : streamOut ? SINK_SPILL : SINK_MEMORY;
     switch (content->type = getMethod(content)) {
     case Squeezed:
         result = unsqueeze(content);
@@ -106,10 +119,7 @@ int processFile(content_t *content, int flags, int depth) {
         break;
     case Library:
         if ((depth == 0 || (flags & RECURSE)) && parseLbr(content)) {
-            int valid = 0;
-            for (content_t *p = content->lbrHead; p; p = p->next) {
-                valid += processFile(p, flags, depth + 1);
-            }
+            int valid = processMembers(content->lbrHead, flags, depth + 1);
             if (content->out.fdate > 0) {
                 content->in.fdate = content->out.fdate; // fixup the actual lbr date but not if invalid
             }
@@ -125,6 +135,10 @@ int processFile(content_t *content, int flags, int depth) {
         setStoreFile(content); // keep list happy with sensible filename & expected length
         return 0;
     }
+    endOutput(content);
+    if (content->status & F_SPILLFAIL) { // the output is incomplete, so it always fails
+        result = CORRUPT;
+    }
     char const *msg;
     if (content->type != Stored) {
         switch (result) {
@@ -139,14 +153,16 @@ int processFile(content_t *content, int flags, int depth) {
             msg = "has invalid CRC";
             break;
         case CORRUPT:
-            msg = "is corrupt";
+            msg = (content->status & F_SPILLFAIL) ? "could not be written to a temporary file"
+                                                  : "is corrupt";
             break;
         default:
             msg = "invalid header";
             break;
         }
 
-        bool ignore   = (result == BADCRC && ignoreCrc) || (result == CORRUPT && ignoreCorrupt);
+        bool ignore   = (result == BADCRC && ignoreCrc) ||
+                      (result == CORRUPT && ignoreCorrupt && !(content->status & F_SPILLFAIL));
         bool lbrCrcOk = depth && !(content->status & (F_BADCRC | F_NOCRC | F_TRUNCATED));
         logErr(content, "!! %s [%s %s] %s, %s%s\n", content->in.fname, methodName(content),
                content->out.fname, msg, ignore ? "ignoring error" : "processing as normal file",
@@ -164,19 +180,120 @@ int processFile(content_t *content, int flags, int depth) {
     return 0;
 }
 
+/*
+    the members of a top level library are independent, so when lbrThreads > 1
+    they are shared across a set of helper threads, largest first to balance the load
+    the helpers allocate their strings from the owning thread's pool and buffer their
+    output, which is replayed in directory order once all of the members are done
+*/
+typedef struct {
+    content_t *content;
+    int seq; // position in the directory
+} member_t;
+
+typedef struct {
+    member_t *members; // sorted largest first
+    char **msgs;       // output of each member, in directory order
+    int count;
+    int next;          // next member to process
+    int flags;
+    int depth;
+    int valid;
+    void *pool;
+    monitor_t *monitor;
+} members_t;
+
+static int cmpSize(void const *a, void const *b) {
+    long sizeA = ((member_t const *)a)->content->in.bufSize;
+    long sizeB = ((member_t const *)b)->content->in.bufSize;
+    return sizeA < sizeB ? 1 : sizeA > sizeB ? -1 : 0;
+}
+
+static void memberWorker(void *arg) {
+    members_t *m = arg;
+    sSharePool(m->pool, m->monitor);
+    bufferMsgs(true);
+    for (;;) {
+        enterMonitor(m->monitor);
+        int index = m->next++;
+        exitMonitor(m->monitor);
+        if (index >= m->count) {
+            break;
+        }
+        member_t *p = &m->members[index];
+        int valid   = processFile(p->content, m->flags, m->depth);
+        char *msg   = takeMsgs();
+
+        enterMonitor(m->monitor);
+        m->msgs[p->seq] = msg;
+        m->valid += valid;
+        exitMonitor(m->monitor);
+    }
+    bufferMsgs(false);
+    sSharePool(NULL, NULL);
+}
+
+// process the members of a library
+// returns the number of non skipped / missing files available
+static int processMembers(content_t *head, int flags, int depth) {
+    members_t m = { .flags = flags, .depth = depth };
+    for (content_t *p = head; p; p = p->next) {
+        m.count++;
+    }
+    if (lbrThreads <= 1 || depth != 1 || m.count < 2) {
+        int valid = 0;
+        for (content_t *p = head; p; p = p->next) {
+            valid += processFile(p, flags, depth);
+        }
+        return valid;
+    }
+
+    m.members = xmalloc(m.count * sizeof(member_t));
+    m.msgs    = xcalloc(m.count, sizeof(char *));
+    int i     = 0;
+    for (content_t *p = head; p; p = p->next, i++) {
+        m.members[i] = (member_t){ p, i };
+    }
+    qsort(m.members, m.count, sizeof(member_t), cmpSize);
+    m.pool    = sPool();
+    m.monitor = newMonitor();
+
+    int nHelpers       = lbrThreads < m.count ? lbrThreads : m.count;
+    thread_t **helpers = xmalloc(nHelpers * sizeof(thread_t *));
+    for (i = 0; i < nHelpers; i++) {
+        helpers[i] = startThread(memberWorker, &m);
+    }
+    for (i = 0; i < nHelpers; i++) {
+        joinThread(helpers[i]);
+    }
+    xfree(helpers);
+    freeMonitor(m.monitor);
+
+    for (i = 0; i < m.count; i++) {
+        if (m.msgs[i]) {
+            msgPrintf("%s", m.msgs[i]);
+            xfree(m.msgs[i]);
+        }
+    }
+    xfree(m.msgs);
+    xfree(m.members);
+    return m.valid;
+}
+
 void displayDate(const time_t date) {
-    struct tm const *timeptr = gmtime(&date);
-    printf("%04d-%02d-%02d %02d:%02d", 1900 + timeptr->tm_year, timeptr->tm_mon + 1,
+    struct tm tmbuf;
+    struct tm const *timeptr = gmtime_r(&date, &tmbuf);
+    msgPrintf("%04d-%02d-%02d %02d:%02d", 1900 + timeptr->tm_year, timeptr->tm_mon + 1,
            timeptr->tm_mday, timeptr->tm_hour, timeptr->tm_min);
 }
 
 void list(content_t *content, time_t defDate, int depth) {
     for (content_t *p = content; p; p = p->next) {
         if (p->msg) {
-            printf("%s", p->msg);
+            msgPrintf("%s", p->msg);
         }
-        printf("%*s", depth * 2, "");
-        printf("%-*s %7ld %-9s", 19 - depth * 2, p->out.fname, p->out.pos, methodName(p));
+        msgPrintf("%*s", depth * 2, "");
+        msgPrintf("%-*s %7ld %-9s", 19 - depth * 2, p->out.fname, p->out.pos, methodName(p));
         switch (p->type) {
         case Crunched:
         case Squeezed:
@@ -185,42 +302,42 @@ void list(content_t *content, time_t defDate, int depth) {
         case CrunchV2:
         case CrLzhV1:
         case CrLzhV2:
-            printf(" (%-12s %7ld) ", p->in.fname, p->in.bufSize);
+            msgPrintf(" (%-12s %7ld) ", p->in.fname, p->in.bufSize);
             break;
         default:
-            printf("%-24c", ' ');
+            msgPrintf("%-24c", ' ');
             break;
         }
-        putchar((p->status & F_BADCRC) ? 'X' : (p->status & F_NOCRC) ? '-' : ' ');
-        putchar(' ');
+        msgPutc((p->status & F_BADCRC) ? 'X' : (p->status & F_NOCRC) ? '-' : ' ');
+        msgPutc(' ');
         if (p->out.fdate) {
             if (0 < p->out.fdate && p->out.fdate <= defDate)
                 displayDate(p->out.fdate);
             else {
                 if (p->type == Library) {
                     displayDate(defDate);
-                    putchar('*');
+                    msgPutc('*');
                 } else
-                    printf("< invalid date >");
+                    msgPrintf("< invalid date >");
                 p->out.fdate = defDate;
             }
         } else {
             if (p->type == Library) {
                 displayDate(defDate);
-                putchar('=');
+                msgPutc('=');
             } else
-                printf("<no date record>");
+                msgPrintf("<no date record>");
             p->out.fdate = defDate;
         }
         if (p->comment) {
-            printf(" %s", p->comment);
+            msgPrintf(" %s", p->comment);
         }
-        putchar('\n');
+        msgPutc('\n');
         if (p->type == Library) {
             if (p->lbrHead) {
                 list(p->lbrHead, p->out.fdate, depth + 1);
             } else {
-                printf(" -- empty library --\n");
+                msgPrintf(" -- empty library --\n");
             }
         }
     }
@@ -233,19 +350,30 @@ void usage(char const *fmt, ...) {
     vfprintf(stderr, fmt, args);
     fprintf(stderr,
             "\n"
-            "Usage: mlbr -v | -V | -h | [-x | -d | -z]  [-D dir] [-f] [-i] [-k] [-n] [-r] [--] file+\n"
+            "Usage: mlbr -v | -V | -h | [-x | -d | -z | -Z zip [-u] | -t | -T tgz] [-a] [-c n] [-D dir] [-f] [-i] [-j n] [-k] [-n] [-r] [-s] [--] file+\n"
             "   -v / -V show version information and exit\n"
             "   -h  show this help and exit\n"
             "   -x  extract to directory\n"
             "   -d  extract lbr to sub directory {name} - see below\n"
             "   -z  convert to zip file {name}.zip\n"
+            "   -Z  convert all files to the single zip file zip, each under directory {name}\n"
+            "   -u  update the -Z zip file, only new or changed files are added\n"
+            "   -t  convert to solid tar file {name}.tar.gz\n"
+            "   -T  convert all files to the single solid tar file tgz, each under directory\n"
+            "       {name}. A tgz of - writes to stdout and the listing to stderr\n"
+            "   -a  batch the writes when extracting, using io_uring on linux\n"
+            "   -c  zip and tar compression level n, 0 (store) to 9, default 6\n"
             "   -D  override target directory\n"
             "   -f  forces write of skipped library content\n"
             "   -i  ignore crc errors\n"
             "   -I  ignore crc errors and corrupt decompression\n"
+            "   -j  process files, or the members of a single library, using n threads\n"
+            "       0 uses one per cpu\n"
             "   -k  keep original case of file names (default is to lower case)\n"
             "   -n  don't expand compressed files\n"
             "   -r  recursively extract lbr, creates nested sub directories for -d or -z\n"
+            "   -s  spill large decoded files to temporary files in the target directory\n"
+            "       rather than holding them in memory\n"
             "   --  terminates args to support files with a leading -\n\n"
 
             " file+ one or more lbr, squeezed, crunched or crLzhed files\n"
@@ -260,43 +388,338 @@ void usage(char const *fmt, ...) {
     exit(*fmt ? 1 : 0);
 }
 
-// expands one file
-// cwd and targetDir should be in cannocial form
-bool expandFile(char const *fname, char const *targetDir, int flags) {
-    bool ok = true;
+// state of one command line file as it passes through the stages of expansion
+typedef struct {
+    char const *fname;
+    char *source; // -Z full path of fname, as recorded in the zip file
     file_t *file;
     content_t *content;
+    char const *archive; // zip or tar file, or the -Z and -T directory the content is named in
+    zipEntries_t *zipEntries; // compressed zip entries waiting to be written
+    tarData_t *tarData;       // -t compressed tar file waiting to be written
+    int saveCnt;
+    bool unchanged; // -u file is already in the zip file
+    void *pool;     // batch mode string pool, NULL for the thread's own
+    char *msgs;     // batch mode listing, written by the writer
+    long size;      // batch mode memory held by the decoded file
+    bool loaded;
+    bool discard;   // batch mode, an earlier file could not be loaded
+} job_t;
 
-    printf("%s:", fname);
-    if (!(file = loadFile(fname))) {
+// load, decode and list the file
+// returns false if the file could not be loaded
+static bool decodeStage(job_t *job, int flags) {
+    if (zipAll) {
+        job->source = zipSourceName(job->fname);
+    }
+    if (update && zipUnchanged(job->source)) {
+        msgPrintf("%s: unchanged in %s\n\n", job->fname, zipAll);
+        job->unchanged = true;
+        return true;
+    }
+    msgPrintf("%s:", job->fname);
+    if (!(job->file = loadFile(job->fname))) {
         return false;
     }
-    putchar('\n');
-    content     = makeDescriptor(file, file->fname, file->buf, file->bufSize);
+    msgPutc('\n');
+    job->content = makeDescriptor(job->file, job->file->fname, job->file->buf, job->file->bufSize);
 
-    int saveCnt = processFile(content, flags, 0);
+    job->saveCnt = processFile(job->content, flags, 0);
 
-    list(content, file->fdate, 0);
-    putchar('\n'); // space from next block of info
-    if (saveCnt != 0 && (flags & SAVEMASK)) {
+    list(job->content, job->file->fdate, 0);
+    msgPutc('\n'); // space from next block of info
+    return true;
+}
+
+// returns true if the content is to be saved, with -Z a file that saves nothing is
+// still recorded in the zip file, so that -u sees it as unchanged next time
+static bool saving(job_t const *job, int flags) {
+    return (flags & SAVEMASK) && !job->unchanged && (job->saveCnt != 0 || zipAll);
+}
+
+// allocate the names the content will be saved as
+// as names are checked for clashes across all of the files, batch mode runs
+// this stage in command line order
+static void nameStage(job_t *job, int flags) {
+    if (saving(job, flags)) {
         if (flags & (EXTRACT | SUBDIR)) {
-            mkOsNames(content, "", flags);
-            ok = saveContent(content, targetDir);
+            mkOsNames(job->content, "", flags);
+        } else if (zipAll) { // laid out as for -z, under the top level directory archive
+            job->archive = zipTopDir(job->source, replaceExt(job->file->fname, ""));
+            mkOsNames(job->content, job->archive, flags);
+        } else if (tarAll) {
+            job->archive = tarTopDir(replaceExt(job->file->fname, ""));
+            mkOsNames(job->content, job->archive, flags);
+        } else if (flags & ZIP) {
+            job->archive = uniqueName("", replaceExt(job->file->fname, ".zip"));
+            mkOsNames(job->content, "", flags);
+        } else if (flags & TGZ) {
+            job->archive = uniqueName("", replaceExt(job->file->fname, ".tar.gz"));
+            mkOsNames(job->content, "", flags);
+        }
+    }
+}
+
+// compress the content for zip and tar files, this needs no file system access
+// so in batch mode it is done by the workers rather than the writer
+static void compressStage(job_t *job, int flags) {
+    if (saving(job, flags)) {
+        if (zipAll) {
+            job->zipEntries = deflateZip(job->content, job->source, job->archive);
         } else if (flags & ZIP) {
-            char const *zipFile = replaceExt(file->fname, ".zip");
-            zipFile             = uniqueName("", zipFile);
-            mkOsNames(content, "", flags);
-            ok = saveZip(content, targetDir, zipFile);
+            job->zipEntries = deflateZip(job->content, NULL, NULL);
+        } else if ((flags & TGZ) && !tarAll) { // -T is one stream, so compressed by addTar
+            job->tarData = deflateTar(job->content);
         }
-        putchar('\n'); // space from next block of info
     }
+}
+
+// write the content, the -Z and -T files have to be added to in command line order
+static void saveStage(job_t *job, char const *targetDir, int flags) {
+    if (saving(job, flags)) {
+        if (flags & (EXTRACT | SUBDIR)) {
+            saveContent(job->content, targetDir, job->file);
+        } else if (zipAll) {
+            addZip(job->zipEntries);
+        } else if (flags & ZIP) {
+            saveZip(job->zipEntries, targetDir, job->archive);
+        } else if (tarAll) {
+            addTar(job->content, job->archive);
+        } else if (flags & TGZ) {
+            saveTar(job->tarData, targetDir, job->archive);
+        }
+        job->zipEntries = NULL;
+        job->tarData    = NULL;
+        msgPutc('\n'); // space from next block of info
+    }
+}
+
+static void freeStage(job_t *job) {
+    freeAllDescriptors(job->content);
+    if (job->pool) {
+        sFreePool(job->pool);
+    } else {
+        sFree(); // clear all of the strings allocated
+    }
+    if (job->file) {
+        unloadFile(job->file);
+    }
+    xfree(job->source);
+}
 
-    freeAllDescriptors(content);
-    sFree(); // clear all of the strings allocated
-    unloadFile(file);
+// expands one file
+// cwd and targetDir should be in cannocial form
+bool expandFile(char const *fname, char const *targetDir, int flags) {
+    job_t job = { .fname = fname };
+
+    if (!decodeStage(&job, flags)) {
+        freeStage(&job);
+        return false;
+    }
+    nameStage(&job, flags);
+    compressStage(&job, flags);
+    saveStage(&job, targetDir, flags);
+    freeStage(&job);
     return true;
 }
 
+/*
+    batch mode, used with -j when there is more than one file
+    the files pass through a pipeline. A reader thread prefetches the files ahead of
+    a pool of worker threads, which decode, name and compress them, and a writer thread
+    does all of the file system output, in command line order. This lets the decoding
+    of the next files overlap with the writing of the previous ones, which matters
+    when the target is slow. To give the same results as a serial run the naming
+    stage is also done in command line order and, as for a serial run, files after one
+    that cannot be loaded are ignored
+    the files that have been started but not written are limited in number and size,
+    though there is always at least one, so memory use stays bounded
+*/
+#define MAXWAITING  4                   // decoded files waiting for the writer
+#define MAXQUEUED   (256 * 1024 * 1024) // bytes held by them
+#define PREFETCH    2                   // files read ahead of the workers
+
+static struct {
+    char **fnames;
+    int count;
+    char const *targetDir;
+    int flags;
+    monitor_t *monitor;
+    job_t **jobs;  // decoded files waiting for the writer, by command line position
+    int next;      // next file to process
+    int nameTurn;  // file allowed to run its naming stage
+    int written;   // files done by the writer
+    int maxFiles;  // limit on the files started but not written
+    long queued;   // memory held by the files waiting for the writer
+    bool stopped;  // set once a file could not be loaded
+} batch;
+
+// wait until it is the turn of file index, the turn is held until passTurn
+static void waitTurn(int const *turn, int index) {
+    enterMonitor(batch.monitor);
+    while (*turn != index) {
+        waitMonitor(batch.monitor);
+    }
+    exitMonitor(batch.monitor);
+}
+
+static void passTurn(int *turn) {
+    enterMonitor(batch.monitor);
+    (*turn)++;
+    notifyMonitor(batch.monitor);
+    exitMonitor(batch.monitor);
+}
+
+// memory held by decoded content, the stored content is part of the loaded file
+// and spilled content is mapped from its temporary file
+static long contentSize(content_t const *content) {
+    long size = 0;
+    for (content_t const *p = content; p; p = p->next) {
+        if (p->lbrHead) {
+            size += contentSize(p->lbrHead);
+        }
+        if (p->out.buf != p->in.buf && !p->out.mapped) {
+            size += p->out.bufSize;
+        }
+    }
+    return size;
+}
+
+static void batchReader(void *arg) {
+    (void)arg;
+    for (int index = 0; index < batch.count; index++) {
+        enterMonitor(batch.monitor);
+        while (index >= batch.next + PREFETCH && !batch.stopped) {
+            waitMonitor(batch.monitor);
+        }
+        bool skip = batch.stopped || index < batch.next; // too late to help
+        exitMonitor(batch.monitor);
+        if (!skip) {
+            prefetchFile(batch.fnames[index]);
+        }
+    }
+}
+
+static void batchWorker(void *arg) {
+    (void)arg;
+    bufferMsgs(true);
+    for (;;) {
+        enterMonitor(batch.monitor);
+        while (batch.next < batch.count && batch.next > batch.written &&
+               (batch.next - batch.written >= batch.maxFiles || batch.queued >= MAXQUEUED)) {
+            waitMonitor(batch.monitor);
+        }
+        int index    = batch.next++;
+        bool stopped = batch.stopped;
+        notifyMonitor(batch.monitor); // the reader can move on
+        exitMonitor(batch.monitor);
+        if (index >= batch.count) {
+            break;
+        }
+
+        job_t *job = xcalloc(1, sizeof(job_t));
+        job->fname = batch.fnames[index];
+        job->pool  = sNewPool(); // the strings are needed until the writer is done
+        sSharePool(job->pool, NULL);
+        job->loaded = !stopped && decodeStage(job, batch.flags);
+
+        waitTurn(&batch.nameTurn, index);
+        job->discard = batch.stopped; // an earlier file could not be loaded
+        if (!job->discard) {
+            if (job->loaded) {
+                nameStage(job, batch.flags);
+            } else {
+                enterMonitor(batch.monitor); // read by the other threads under the monitor
+                batch.stopped = true;
+                exitMonitor(batch.monitor);
+            }
+        }
+        passTurn(&batch.nameTurn);
+
+        if (job->loaded && !job->discard) {
+            compressStage(job, batch.flags);
+        }
+        sSharePool(NULL, NULL);
+        job->msgs = takeMsgs();
+        job->size = job->file ? job->file->bufSize + contentSize(job->content) : 0;
+        if (job->zipEntries) {
+            job->size += zipEntriesSize(job->zipEntries);
+        }
+        if (job->tarData) {
+            job->size += tarDataSize(job->tarData);
+        }
+
+        enterMonitor(batch.monitor);
+        batch.jobs[index] = job;
+        batch.queued += job->size;
+        notifyMonitor(batch.monitor);
+        exitMonitor(batch.monitor);
+    }
+    bufferMsgs(false);
+}
+
+// the only thread to write files once the workers have started
+static void batchWriter(void *arg) {
+    (void)arg;
+    for (int index = 0; index < batch.count; index++) {
+        enterMonitor(batch.monitor);
+        while (!batch.jobs[index]) {
+            waitMonitor(batch.monitor);
+        }
+        job_t *job = batch.jobs[index];
+        exitMonitor(batch.monitor);
+
+        if (job->msgs && !job->discard) {
+            msgPrintf("%s", job->msgs);
+        }
+        if (job->loaded && !job->discard) {
+            sSharePool(job->pool, NULL);
+            saveStage(job, batch.targetDir, batch.flags);
+            sSharePool(NULL, NULL);
+        }
+        freeStage(job);
+
+        enterMonitor(batch.monitor);
+        batch.jobs[index] = NULL;
+        batch.queued -= job->size;
+        batch.written = index + 1;
+        notifyMonitor(batch.monitor);
+        exitMonitor(batch.monitor);
+        xfree(job->msgs);
+        xfree(job);
+    }
+}
+
+// expand the files through the pipeline
+// returns false if a file could not be loaded
+bool expandBatch(char **fnames, int count, char const *targetDir, int flags) {
+    int nWorkers       = jobs < count ? jobs : count;
+    thread_t **workers = xmalloc(nWorkers * sizeof(thread_t *));
+
+    batch.fnames    = fnames;
+    batch.count     = count;
+    batch.targetDir = targetDir;
+    batch.flags     = flags;
+    batch.monitor   = newMonitor();
+    batch.jobs      = xcalloc(count, sizeof(job_t *));
+    batch.maxFiles  = nWorkers + MAXWAITING;
+
+    thread_t *reader = startThread(batchReader, NULL);
+    thread_t *writer = startThread(batchWriter, NULL);
+    for (int i = 0; i < nWorkers; i++) {
+        workers[i] = startThread(batchWorker, NULL);
+    }
+    for (int i = 0; i < nWorkers; i++) {
+        joinThread(workers[i]);
+    }
+    joinThread(writer);
+    joinThread(reader);
+    xfree(workers);
+    xfree(batch.jobs);
+    freeMonitor(batch.monitor);
+    return !batch.stopped;
+}
+
 int parseOptions(int argc, char **argv) {
     int arg;
     int saveOpt = 0;
@@ -322,6 +745,37 @@ int parseOptions(int argc, char **argv) {
             flags |= ZIP;
             saveOpt++;
             break;
+        case 'Z':
+            if (++arg < argc) {
+                zipAll = argv[arg];
+                flags |= ZIP;
+                saveOpt++;
+            } else {
+                usage("Missing zip file for -Z option\n");
+            }
+            break;
+        case 't':
+            flags |= TGZ;
+            saveOpt++;
+            break;
+        case 'T':
+            if (++arg < argc) {
+                tarAll = argv[arg];
+                flags |= TGZ;
+                saveOpt++;
+            } else {
+                usage("Missing tar file for -T option\n");
+            }
+            break;
+        case 'u':
+            update = true;
+            break;
+        case 'a':
+            asyncIo = true;
+            break;
+        case 's':
+            streamOut = true;
+            break;
         case 'f':
             flags |= FORCE;
             break;
@@ -345,12 +799,31 @@ int parseOptions(int argc, char **argv) {
                 usage("Missing directory for -D option\n");
             }
             break;
+        case 'c':
+            if (++arg < argc && isdigit(argv[arg][0]) && argv[arg][1] == '\0') {
+                zipLevel = argv[arg][0] - '0';
+            } else {
+                usage("Missing or invalid compression level for -c option\n");
+            }
+            break;
+        case 'j':
+            if (++arg < argc && isdigit(argv[arg][0])) {
+                if ((jobs = atoi(argv[arg])) == 0) {
+                    jobs = cpuCount();
+                }
+            } else {
+                usage("Missing thread count for -j option\n");
+            }
+            break;
         default:
             usage("Invalid option %s\n", argv[arg]);
         }
     }
     if (saveOpt > 1) {
-        usage("only one of -x, -d and -z allowed\n");
+        usage("only one of -x, -d, -z, -Z, -t and -T allowed\n");
+    }
+    if (update && !zipAll) {
+        usage("-u is only valid with -Z\n");
     }
     return arg;
 }
@@ -358,6 +831,7 @@ int main(int argc, char **argv) {
     bool ok = true;
 
     CHK_SHOW_VERSION(argc, argv);
+    initCrc();
     if (argc == 2 && strcmp(argv[1], "-h") == 0)
         usage("");
 
@@ -389,6 +863,7 @@ int main(int argc, char **argv) {
     }
 
     srcDstSame = nameCmp(fullTargetDir, cwd) == 0;
+    spillDir   = fullTargetDir; // on the same file system as the output, rather than say tmpfs
 
     if (flags & SAVEMASK) { // will be saving to protect all of the source files if necessary
         for (int i = arg; i < argc; i++) {
@@ -396,10 +871,27 @@ int main(int argc, char **argv) {
         }
     }
 
-    for (; arg < argc; arg++) {
-        ok = ok && expandFile(argv[arg], fullTargetDir, flags);
+    if (zipAll && !openZip(fullTargetDir, zipAll, update)) {
+        exit(1);
+    }
+    if (tarAll && !openTar(fullTargetDir, tarAll)) {
+        exit(1);
+    }
+    if (jobs > 1 && argc - arg > 1) {
+        ok = expandBatch(argv + arg, argc - arg, fullTargetDir, flags);
+    } else {
+        lbrThreads = jobs; // single file, so use the threads on the library members
+        for (; arg < argc; arg++) {
+            ok = ok && expandFile(argv[arg], fullTargetDir, flags);
+        }
     }
 
+    if (zipAll) {
+        ok = closeZip() && ok;
+    }
+    if (tarAll) {
+        ok = closeTar() && ok;
+    }
     if (fullTargetDir != cwd) {
         free(fullTargetDir);
     }
@@ -35,23 +35,29 @@ file_t *loadFile(char const *name) {
     file_t *file = NULL;
 
     if ((fp = fopen(name, "rb")) == NULL) {
-        puts(" cannot open");
+        msgPrintf(" cannot open\n");
         return NULL;
     }
     if (fstat(fileno(fp), &statBuf) != 0) {
-        puts(" problems reading");
+        msgPrintf(" problems reading\n");
     } else {
         file          = xcalloc(1, sizeof(file_t));
         file->bufSize = statBuf.st_size;
-        file->buf     = xmalloc((size_t)file->bufSize);
-        if (fread(file->buf, 1, (size_t)file->bufSize, fp) == file->bufSize) {
+        if ((file->buf = mapFile(fp, file->bufSize))) { // the input is never modified
+            file->mapped = true;
+        } else {
+            file->buf = xmalloc((size_t)file->bufSize);
+        }
+        if (file->mapped || fread(file->buf, 1, (size_t)file->bufSize, fp) == file->bufSize) {
             file->fdate = getFileTime(fp);
             file->fname = mapCase(xstrdup(nameOnly(name)));
+            file->fp    = fp; // closed by unloadFile
+            return file;
         } else {
             xfree(file->buf);
             xfree(file);
             file = NULL;
-            puts(" problem reading");
+            msgPrintf(" problem reading\n");
         }
     }
     fclose(fp);
@@ -60,7 +66,12 @@ file_t *loadFile(char const *name) {
 
 // release the real file and internal memory it used
 void unloadFile(file_t *file) {
-    xfree(file->buf);
+    if (file->mapped) {
+        unmapFile(file->buf, file->bufSize);
+    } else {
+        xfree(file->buf);
+    }
+    fclose(file->fp);
     xfree(file);
 }
 
@@ -75,6 +86,7 @@ content_t *makeDescriptor(file_t const *file, char const *name, uint8_t *start,
     content->in.fname  = name;
     content->in.fdate  = file->fdate;
     content->length    = length; // expected length
+    content->lbrCrc    = -1;
 
     if (start && start + length > file->buf + file->bufSize) { // is it past the end of the file
         content->in.bufSize = (long)((file->buf + file->bufSize) - start);
@@ -91,6 +103,15 @@ content_t *makeDescriptor(file_t const *file, char const *name, uint8_t *start,
     return content;
 }
 
+// free the decoded output, which may be mapped from a spill file
+static void freeOutput(content_t *content) {
+    if (content->out.mapped) {
+        unmapFile(content->out.buf, content->out.bufSize);
+    } else {
+        xfree(content->out.buf);
+    }
+}
+
 // free all allocated descriptors (string space is freed separately)
 
 void freeAllDescriptors(content_t *content) {
@@ -103,73 +124,252 @@ void freeAllDescriptors(content_t *content) {
             freeAllDescriptors(p->lbrHead); // free up containers
         }
         if (p->out.buf && p->out.buf != p->in.buf) {
-            xfree(p->out.buf);
+            freeOutput(p);
         }
         xfree(p);
     }
 }
 
-// takes a descriptor pointing to a potential chain of other descriptors
-// and saves the decompressed content to real files
-// library containers call this function recursively
-// returns true if everything is ok
-bool saveContent(content_t const *content, char const *targetDir) {
-    bool ok = true;
+// returns the number of bytes of output to save
+// a truncated file that is forced to be saved only has the data actually present
+long outLength(content_t const *content) {
+    return content->out.pos > content->out.bufSize ? content->out.bufSize : content->out.pos;
+}
+
+// write the content to fp, stored content is a copy of part of the source file src
+// so where possible it is copied directly from the file rather than written from memory
+static bool writeContent(content_t const *content, file_t const *src, FILE *fp) {
+    long len    = outLength(content);
+    long copied = 0;
+    if (content->type == Stored && src && content->out.buf >= src->buf &&
+        content->out.buf + len <= src->buf + src->bufSize) {
+        copied = copyRange(src->fp, (long)(content->out.buf - src->buf), len, fp);
+    }
+    return fwrite(content->out.buf + copied, 1, len - copied, fp) == (size_t)(len - copied);
+}
+
+// report the name a file was saved as, if it was renamed, and any error
+void saveMsg(content_t const *content, char const *err) {
+    if (nameCmp(nameOnly(content->savePath), content->out.fname) != 0) {
+        msgPrintf("%s -> %s%s\n", content->out.fname, content->savePath, err);
+    } else if (*err) {
+        msgPrintf("%s%s\n", content->savePath, err);
+    }
+}
+
+// saves content into the directory dir, whose savePath is dirPath
+// files and sub directories are created relative to dir using the part of their savePath
+// after dirPath, or if they are not under dirPath, e.g. a library's .info file,
+// relative to the target directory top
+// if aw is not NULL the files and sub directories are completed by endAsyncWrites
+static bool saveInDir(content_t const *content, dir_t top, dir_t dir, char const *dirPath,
+                      file_t const *src, asyncWrites_t *aw) {
+    bool ok       = true;
+    size_t dirLen = strlen(dirPath);
 
     for (; content; content = content->next) {
-        char const *savePath = makeFullPath(targetDir, content->savePath ? content->savePath : "");
+        char const *name = content->savePath ? content->savePath : "";
+        dir_t at         = top;
+        if (dirLen && strncmp(name, dirPath, dirLen) == 0 && ISDIRSEP(name[dirLen])) {
+            name += dirLen + 1;
+            at = dir;
+        }
         char const *err;
         switch (content->type) {
         case Skipped:
         case Missing:
             break;
         case Library:
-            if (content->savePath) {
-                if (!safeMkdir(savePath)) {
-                    printf("%s - cannot create sub directory\n", content->savePath);
-                    ok = false;
+            if (!content->savePath) { // -x, the members are saved in the same directory
+                ok = saveInDir(content->lbrHead, top, dir, dirPath, src, aw) && ok;
+                break;
+            }
+            dir_t subDir = openDir(at, name, true);
+            if (subDir == NODIR) {
+                if (aw) { // the earlier files' messages come first, as they do without -a
+                    flushAsyncWrites(aw);
+                }
+                msgPrintf("%s - cannot create sub directory\n", content->savePath);
+                ok = false;
+            } else {
+                ok = saveInDir(content->lbrHead, top, subDir, content->savePath, src, aw) && ok;
+                if (aw) {
+                    asyncDir(aw, subDir, content->out.fdate);
                 } else {
-                    setFileTime(savePath, content->out.fdate);
+                    setDirTime(subDir, content->out.fdate); // after its content has been added
+                    closeDir(subDir);
                 }
             }
-            ok = saveContent(content->lbrHead, targetDir) && ok;
             break;
         default:
+            if (aw) {
+                asyncWrite(aw, at, name, content);
+                break;
+            }
             err      = "";
-            FILE *fp = fopen(savePath, "wb");
+            FILE *fp = createFile(at, name);
             if (fp == NULL) {
                 err = " - could not create file";
                 ok  = false;
-            } else if (fwrite(content->out.buf, 1, content->out.pos, fp) != content->out.pos) {
+            } else if (!writeContent(content, src, fp)) {
                 fclose(fp);
-                unlink(savePath);
+                removeFile(at, name);
                 err = " - problem writing file";
                 ok  = false;
             } else {
+                setOpenFileTime(fp, content->out.fdate);
                 fclose(fp);
-                setFileTime(savePath, content->out.fdate);
-            }
-            if (nameCmp(nameOnly(content->savePath), content->out.fname) != 0) {
-                printf("%s -> %s%s\n", content->out.fname, content->savePath, err);
-            } else if (*err) {
-                printf("%s%s\n", content->savePath, err);
             }
+            saveMsg(content, err);
         }
     }
     return ok;
 }
 
+// takes a descriptor pointing to a potential chain of other descriptors
+// and saves the decompressed content to real files in targetDir
+// src is the file the content was loaded from
+// with -a the writes are batched using io_uring where it is available
+// returns true if everything is ok
+bool saveContent(content_t const *content, char const *targetDir, file_t const *src) {
+    dir_t dir = openDir(NODIR, targetDir, false);
+    if (dir == NODIR) {
+        msgPrintf("%s - cannot open directory\n", targetDir);
+        return false;
+    }
+    asyncWrites_t *aw = asyncIo ? startAsyncWrites() : NULL;
+    bool ok           = saveInDir(content, dir, dir, "", src, aw);
+    if (aw) {
+        ok = endAsyncWrites(aw) && ok;
+    }
+    closeDir(dir);
+    return ok;
+}
+
+#define CHECKBLOCK  4096    // output bytes between updates of the check value
+#define STREAMCHUNK 0x10000 // largest output buffer for the spill and discard sinks
+
+/*
+    decoded output is normally held in a buffer that grows to take all of it
+    when nothing is being saved the output is only needed for its check value, so
+    the discard sink drops each full buffer, keeping memory use constant. With -s
+    the spill sink writes each full buffer to a temporary file in spillDir, the
+    target directory, as the system temporary directory may itself be in memory
+    endOutput then maps the file into memory, so the output is backed by the file
+    in both cases out.buf holds the output from position outBase onwards
+    if the spill file cannot be written the rest of the output is discarded, so it is
+    still checked, and processFile fails the file
+*/
+static void spillFailed(content_t *content) {
+    if (content->out.fp) {
+        fclose(content->out.fp);
+        content->out.fp = NULL;
+    }
+    content->status |= F_SPILLFAIL;
+    content->sink = SINK_DISCARD;
+}
+
+// out.buf is full, so grow it or pass its content to the sink
+static void growOutput(content_t *content) {
+    if (content->sink != SINK_MEMORY && content->out.bufSize >= STREAMCHUNK) {
+        updateCheck(content); // whilst the data is still available
+        if (content->sink == SINK_SPILL) {
+            if ((!content->out.fp && !(content->out.fp = tempFile(spillDir))) ||
+                fwrite(content->out.buf, 1, content->out.bufSize, content->out.fp) !=
+                    (size_t)content->out.bufSize) {
+                spillFailed(content);
+            }
+        }
+        content->outBase += content->out.bufSize;
+        return;
+    }
+    long size = content->out.bufSize * 2;
+    if (size == 0) {
+        size = content->in.bufSize * 2 < MINALLOC ? MINALLOC : content->in.bufSize * 2;
+    }
+    if (content->sink != SINK_MEMORY && size > STREAMCHUNK) {
+        size = STREAMCHUNK;
+    }
+    content->out.bufSize = size;
+    content->out.buf     = xrealloc(content->out.buf, content->out.bufSize);
+}
+
 void outU8(uint8_t c, content_t *content) {
-    if (content->out.pos >= content->out.bufSize) {
-        if (content->out.bufSize) {
-            content->out.bufSize *= 2;
+    if (content->out.pos - content->checkPos >= CHECKBLOCK && content->check) {
+        updateCheck(content);
+    }
+    if (content->out.pos - content->outBase >= content->out.bufSize) {
+        growOutput(content);
+    }
+    content->out.buf[content->out.pos++ - content->outBase] = c;
+}
+
+// called once decoding is done, spilled output is mapped back in so that it can
+// be saved as normal and discarded output is freed
+void endOutput(content_t *content) {
+    if (content->outBase == 0) { // still all in out.buf
+        return;
+    }
+    updateCheck(content);
+    uint8_t *buf = NULL;
+    bool mapped  = false;
+    if (content->sink == SINK_SPILL) {
+        FILE *fp = content->out.fp;
+        long len = content->out.pos - content->outBase;
+        if (fwrite(content->out.buf, 1, len, fp) == (size_t)len && fflush(fp) == 0) {
+            if ((buf = mapFile(fp, content->out.pos))) {
+                mapped = true;
+            } else {
+                buf = xmalloc(content->out.pos);
+                rewind(fp);
+                if (fread(buf, 1, content->out.pos, fp) != (size_t)content->out.pos) {
+                    xfree(buf);
+                    buf = NULL;
+                }
+            }
+        }
+        if (buf) {
+            fclose(fp); // a mapping stays valid and the file goes once it is unmapped
         } else {
-            content->out.bufSize =
-                content->in.bufSize * 2 < MINALLOC ? MINALLOC : content->in.bufSize * 2;
+            spillFailed(content);
         }
-        content->out.buf = xrealloc(content->out.buf, content->out.bufSize);
     }
-    content->out.buf[content->out.pos++] = c;
+    xfree(content->out.buf);
+    content->out.buf     = buf;
+    content->out.bufSize = buf ? content->out.pos : 0;
+    content->out.mapped  = mapped;
+    content->out.fp      = NULL;
+    content->outBase     = 0;
+}
+
+/*
+    the checksum or CRC of the decoded output is accumulated as it is written
+    a block at a time whilst the data is still in cache, rather than in a
+    separate pass over the whole output once decoding is complete
+*/
+void updateCheck(content_t *content) {
+    uint8_t const *s = content->out.buf + (content->checkPos - content->outBase);
+    long len         = content->out.pos - content->checkPos;
+    if (content->check == CHK_CRC16) {
+        content->checkVal = crc16Update(content->checkVal, s, len);
+    } else if (content->check == CHK_SUM) {
+        content->checkVal = crcUpdate(content->checkVal, s, len);
+    }
+    content->checkPos = content->out.pos;
+}
+
+// start accumulating a check value on the output from its current position
+void startCheck(content_t *content, int check) {
+    content->check    = check;
+    content->checkVal = 0;
+    content->checkPos = content->out.pos;
+}
+
+// returns the check value for all of the output written since startCheck
+uint16_t endCheck(content_t *content) {
+    updateCheck(content);
+    content->check = CHK_NONE;
+    return content->checkVal;
 }
 
 void outStr(content_t *content, char const *fmt, ...) {
@@ -188,24 +388,21 @@ void outStr(content_t *content, char const *fmt, ...) {
 }
 
 void outRle(int val, content_t *content) {
-    static bool repeatFlag;
-    static int lastCh;
-
     if (val < 0) {
-        repeatFlag = false;
-    } else if (repeatFlag) {
-        repeatFlag = false;
+        content->repeatFlag = false;
+    } else if (content->repeatFlag) {
+        content->repeatFlag = false;
         if (val == 0) {
             outU8(REPEAT_CHAR, content);
         } else {
             while (--val > 0) {
-                outU8(lastCh, content);
+                outU8(content->lastCh, content);
             }
         }
     } else if (val == REPEAT_CHAR) {
-        repeatFlag = true;
+        content->repeatFlag = true;
     } else {
-        outU8(lastCh = val, content);
+        outU8(content->lastCh = val, content);
     }
 }
 
@@ -236,30 +433,17 @@ bool inSeek(content_t *content, long offset) {
     return true;
 }
 
-int inBits(content_t *content, uint8_t count) {
-    while (count > content->bitCount) {
-        if (isEof(content)) {
-            return EOF;
-        }
-        content->bitStream = (content->bitStream << 8) + content->in.buf[content->in.pos++];
-        content->bitCount += 8;
-    }
-    content->bitCount -= count;
-    return (content->bitStream >> content->bitCount) & ~(~0U << count);
-}
-
-int inBitRev(content_t *content) {
-    if ((content->bitStream >>= 1) <= 1) { // no data left //-V1019
-        if (isEof(content)) {
-            return EOF;
-        }
-        content->bitStream = content->in.buf[content->in.pos++] + 0x100; // byte + marker
-    }
-    return content->bitStream & 1;
+// return any whole unused bytes held by the bit reader to the input
+// partially used bytes are skipped
+void endBits(content_t *content) {
+    content->in.pos -= content->bitCount / 8;
+    content->bitCount  = 0;
+    content->bitStream = 0;
 }
 
 void setStoreFile(content_t *content) {
-    xfree(content->out.buf);
+    freeOutput(content);
+    content->check   = CHK_NONE;
     content->comment = NULL;
     time_t tmp         = content->out.fdate; // keep date info as list will use before fixing
     content->out     = content->in; // set up to store / skip the file
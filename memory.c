@@ -34,6 +34,11 @@
     used else additional STRALLOC blocks are allocated as necessary
     for requests > STRALLOC then the requested size + STRALLOC is allocated
     sFree is used to free any dynamic strings
+    Each thread has its own string pool, so threads allocate and free strings
+    independently. Threads helping to decode a library can temporarily share
+    the pool of the thread that owns the library, see sSharePool
+    In batch mode each file has a pool of its own, from sNewPool, as its strings
+    are still needed by the writer after the worker has moved on to another file
 */
 #define STRALLOC 8192
 
@@ -46,10 +51,12 @@ typedef struct _str {
     char str[STRALLOC];
 } str_t;
 
-static str_t stringMem = { .strSize = STRALLOC };
+static THREAD_LOCAL str_t stringMem = { .strSize = STRALLOC };
+static THREAD_LOCAL str_t *sharedMem;      // another thread's pool if sharing
+static THREAD_LOCAL monitor_t *sharedLock; // and the lock protecting it
 
-char *sAlloc(size_t n) {
-    for (str_t *p = &stringMem;; p = p->next) {
+static char *allocFrom(str_t *p, size_t n) {
+    for (;; p = p->next) {
         if (p->lastLoc + n <= p->strSize) {
             char *str = p->str + p->lastLoc;
             p->lastLoc += n;
@@ -63,6 +70,46 @@ char *sAlloc(size_t n) {
     }
 }
 
+char *sAlloc(size_t n) {
+    if (sharedMem && sharedLock) {
+        enterMonitor(sharedLock);
+        char *str = allocFrom(sharedMem, n);
+        exitMonitor(sharedLock);
+        return str;
+    }
+    return allocFrom(sharedMem ? sharedMem : &stringMem, n);
+}
+
+// returns the pool the calling thread is using, for use by sSharePool
+void *sPool() {
+    return sharedMem ? sharedMem : &stringMem;
+}
+
+// make the calling thread allocate strings from pool, using lock to serialise access
+// lock can be NULL if no other thread is using the pool
+// the pool's owner must not allocate whilst it is shared
+// sSharePool(NULL, NULL) reverts to the thread's own pool
+void sSharePool(void *pool, monitor_t *lock) {
+    sharedMem  = pool;
+    sharedLock = lock;
+}
+
+// create an empty pool, see sSharePool and sFreePool
+void *sNewPool() {
+    str_t *pool   = xcalloc(1, sizeof(str_t));
+    pool->strSize = STRALLOC;
+    return pool;
+}
+
+// free a pool created by sNewPool and all of its strings
+void sFreePool(void *pool) {
+    str_t *q;
+    for (str_t *p = pool; p; p = q) {
+        q = p->next;
+        xfree(p);
+    }
+}
+
 void sFree() {
     str_t *q;
     for (str_t *p = stringMem.next; p; p = q) {
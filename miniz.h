@@ -1190,6 +1190,19 @@ mz_ulong mz_adler32(mz_ulong adler, const unsigned char *ptr, size_t buf_len) {
 // Karl Malbrain's compact CRC-32. See "A compact CCITT crc16 and crc32 C
 // implementation that balances processor cache usage against speed":
 // http://www.geocities.com/malbrain/
+#ifdef MINIZ_EXTERNAL_CRC32
+// use the application's crc32, which has faster implementations
+uint32_t MINIZ_EXTERNAL_CRC32(uint32_t crc, const uint8_t *data, long len);
+
+mz_ulong mz_crc32(mz_ulong crc, const mz_uint8 *ptr, size_t buf_len) {
+  mz_uint32 crcu32 = (mz_uint32)crc;
+  if (!ptr)
+    return MZ_CRC32_INIT;
+  for (; buf_len > 0x40000000; buf_len -= 0x40000000, ptr += 0x40000000)
+    crcu32 = MINIZ_EXTERNAL_CRC32(crcu32, ptr, 0x40000000);
+  return MINIZ_EXTERNAL_CRC32(crcu32, ptr, (long)buf_len);
+}
+#else
 mz_ulong mz_crc32(mz_ulong crc, const mz_uint8 *ptr, size_t buf_len) {
   static const mz_uint32 s_crc32[16] = {
       0,          0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4,
@@ -1206,6 +1219,7 @@ mz_ulong mz_crc32(mz_ulong crc, const mz_uint8 *ptr, size_t buf_len) {
   }
   return ~crcu32;
 }
+#endif
 
 void mz_free(void *p) { MZ_FREE(p); }
 
@@ -3276,7 +3290,8 @@ static void mz_zip_time_t_to_dos_time(time_t time, mz_uint16 *pDOS_time,
     return;
   }
 #else
-  struct tm *tm = localtime(&time);
+  struct tm tm_struct;
+  struct tm *tm = localtime_r(&time, &tm_struct);
 #endif /* #ifdef _MSC_VER */
 
   *pDOS_time = (mz_uint16)(((tm->tm_hour) << 11) + ((tm->tm_min) << 5) +
@@ -3338,8 +3353,13 @@ static void mz_write_le32(mz_uint8 *p, mz_uint32 v) {
   p[2] = (mz_uint8)(v >> 16);
   p[3] = (mz_uint8)(v >> 24);
 }
+static void mz_write_le64(mz_uint8 *p, mz_uint64 v) {
+  mz_write_le32(p, (mz_uint32)v);
+  mz_write_le32(p + 4, (mz_uint32)(v >> 32));
+}
 #define MZ_WRITE_LE16(p, v) mz_write_le16((mz_uint8 *)(p), (mz_uint16)(v))
 #define MZ_WRITE_LE32(p, v) mz_write_le32((mz_uint8 *)(p), (mz_uint32)(v))
+#define MZ_WRITE_LE64(p, v) mz_write_le64((mz_uint8 *)(p), (mz_uint64)(v))
 
 mz_bool mz_zip_writer_init(mz_zip_archive *pZip, mz_uint64 existing_size) {
   if ((!pZip) || (pZip->m_pState) || (!pZip->m_pWrite) ||
@@ -3498,22 +3518,54 @@ static mz_bool mz_zip_writer_create_central_dir_header(
   memset(pDst, 0, MZ_ZIP_CENTRAL_DIR_HEADER_SIZE);
   MZ_WRITE_LE32(pDst + MZ_ZIP_CDH_SIG_OFS, MZ_ZIP_CENTRAL_DIR_HEADER_SIG);
   MZ_WRITE_LE16(pDst + MZ_ZIP_CDH_VERSION_MADE_BY_OFS, version_made_by);
-  MZ_WRITE_LE16(pDst + MZ_ZIP_CDH_VERSION_NEEDED_OFS, method ? 20 : 0);
+  // values that do not fit are held in a zip64 extended information field
+  mz_bool zip64 = (uncomp_size >= MZ_UINT32_MAX) || (comp_size >= MZ_UINT32_MAX) ||
+                  (local_header_ofs >= MZ_UINT32_MAX);
+  MZ_WRITE_LE16(pDst + MZ_ZIP_CDH_VERSION_NEEDED_OFS, zip64 ? 45 : method ? 20 : 0);
   MZ_WRITE_LE16(pDst + MZ_ZIP_CDH_BIT_FLAG_OFS, bit_flags);
   MZ_WRITE_LE16(pDst + MZ_ZIP_CDH_METHOD_OFS, method);
   MZ_WRITE_LE16(pDst + MZ_ZIP_CDH_FILE_TIME_OFS, dos_time);
   MZ_WRITE_LE16(pDst + MZ_ZIP_CDH_FILE_DATE_OFS, dos_date);
   MZ_WRITE_LE32(pDst + MZ_ZIP_CDH_CRC32_OFS, uncomp_crc32);
-  MZ_WRITE_LE32(pDst + MZ_ZIP_CDH_COMPRESSED_SIZE_OFS, comp_size);
-  MZ_WRITE_LE32(pDst + MZ_ZIP_CDH_DECOMPRESSED_SIZE_OFS, uncomp_size);
+  MZ_WRITE_LE32(pDst + MZ_ZIP_CDH_COMPRESSED_SIZE_OFS,
+                MZ_MIN(comp_size, MZ_UINT32_MAX));
+  MZ_WRITE_LE32(pDst + MZ_ZIP_CDH_DECOMPRESSED_SIZE_OFS,
+                MZ_MIN(uncomp_size, MZ_UINT32_MAX));
   MZ_WRITE_LE16(pDst + MZ_ZIP_CDH_FILENAME_LEN_OFS, filename_size);
   MZ_WRITE_LE16(pDst + MZ_ZIP_CDH_EXTRA_LEN_OFS, extra_size);
   MZ_WRITE_LE16(pDst + MZ_ZIP_CDH_COMMENT_LEN_OFS, comment_size);
   MZ_WRITE_LE32(pDst + MZ_ZIP_CDH_EXTERNAL_ATTR_OFS, ext_attributes);
-  MZ_WRITE_LE32(pDst + MZ_ZIP_CDH_LOCAL_HEADER_OFS, local_header_ofs);
+  MZ_WRITE_LE32(pDst + MZ_ZIP_CDH_LOCAL_HEADER_OFS,
+                MZ_MIN(local_header_ofs, MZ_UINT32_MAX));
   return MZ_TRUE;
 }
 
+// builds the zip64 extended information field for a central directory entry
+// returns its size, 0 if it is not needed
+static mz_uint16 mz_zip_writer_create_zip64_extra(mz_uint8 *pDst,
+                                                  mz_uint64 uncomp_size,
+                                                  mz_uint64 comp_size,
+                                                  mz_uint64 local_header_ofs) {
+  mz_uint8 *p = pDst + 4;
+  if (uncomp_size >= MZ_UINT32_MAX) {
+    MZ_WRITE_LE64(p, uncomp_size);
+    p += 8;
+  }
+  if (comp_size >= MZ_UINT32_MAX) {
+    MZ_WRITE_LE64(p, comp_size);
+    p += 8;
+  }
+  if (local_header_ofs >= MZ_UINT32_MAX) {
+    MZ_WRITE_LE64(p, local_header_ofs);
+    p += 8;
+  }
+  if (p == pDst + 4)
+    return 0;
+  MZ_WRITE_LE16(pDst, MZ_ZIP64_EXTENDED_INFORMATION_FIELD_HEADER_ID);
+  MZ_WRITE_LE16(pDst + 2, p - pDst - 4);
+  return (mz_uint16)(p - pDst);
+}
+
 static mz_bool mz_zip_writer_add_to_central_dir(
     mz_zip_archive *pZip, const char *pFilename, mz_uint16 filename_size,
     const void *pExtra, mz_uint16 extra_size, const void *pComment,
@@ -3525,16 +3577,19 @@ static mz_bool mz_zip_writer_add_to_central_dir(
   mz_uint32 central_dir_ofs = (mz_uint32)pState->m_central_dir.m_size;
   size_t orig_central_dir_size = pState->m_central_dir.m_size;
   mz_uint8 central_dir_header[MZ_ZIP_CENTRAL_DIR_HEADER_SIZE];
-
-  // No zip64 support yet
-  if ((local_header_ofs > 0xFFFFFFFF) ||
-      (((mz_uint64)pState->m_central_dir.m_size +
-        MZ_ZIP_CENTRAL_DIR_HEADER_SIZE + filename_size + extra_size +
-        comment_size) > 0xFFFFFFFF))
+  mz_uint8 zip64_extra[4 + 3 * sizeof(mz_uint64)];
+  mz_uint16 zip64_size = mz_zip_writer_create_zip64_extra(
+      zip64_extra, uncomp_size, comp_size, local_header_ofs);
+
+  // the offsets into the central directory are only 32 bit
+  if (((mz_uint64)pState->m_central_dir.m_size +
+       MZ_ZIP_CENTRAL_DIR_HEADER_SIZE + filename_size + zip64_size +
+       extra_size + comment_size) > 0xFFFFFFFF)
     return MZ_FALSE;
 
   if (!mz_zip_writer_create_central_dir_header(
-          pZip, central_dir_header, filename_size, extra_size, comment_size,
+          pZip, central_dir_header, filename_size, zip64_size + extra_size,
+          comment_size,
           uncomp_size, comp_size, uncomp_crc32, method, bit_flags, dos_time,
           dos_date, local_header_ofs, ext_attributes))
     return MZ_FALSE;
@@ -3543,6 +3598,8 @@ static mz_bool mz_zip_writer_add_to_central_dir(
                                MZ_ZIP_CENTRAL_DIR_HEADER_SIZE)) ||
       (!mz_zip_array_push_back(pZip, &pState->m_central_dir, pFilename,
                                filename_size)) ||
+      (!mz_zip_array_push_back(pZip, &pState->m_central_dir, zip64_extra,
+                               zip64_size)) ||
       (!mz_zip_array_push_back(pZip, &pState->m_central_dir, pExtra,
                                extra_size)) ||
       (!mz_zip_array_push_back(pZip, &pState->m_central_dir, pComment,
@@ -3780,18 +3837,14 @@ mz_bool mz_zip_writer_finalize_archive(mz_zip_archive *pZip) {
   mz_zip_internal_state *pState;
   mz_uint64 central_dir_ofs, central_dir_size;
   mz_uint8 hdr[MZ_ZIP_END_OF_CENTRAL_DIR_HEADER_SIZE];
+  mz_uint8 hdr64[MZ_ZIP64_END_OF_CENTRAL_DIR_HEADER_SIZE +
+                 MZ_ZIP64_END_OF_CENTRAL_DIR_LOCATOR_SIZE];
 
   if ((!pZip) || (!pZip->m_pState) || (pZip->m_zip_mode != MZ_ZIP_MODE_WRITING))
     return MZ_FALSE;
 
   pState = pZip->m_pState;
 
-  // no zip64 support yet
-  if ((pZip->m_total_files > 0xFFFF) ||
-      ((pZip->m_archive_size + pState->m_central_dir.m_size +
-        MZ_ZIP_END_OF_CENTRAL_DIR_HEADER_SIZE) > 0xFFFFFFFF))
-    return MZ_FALSE;
-
   central_dir_ofs = 0;
   central_dir_size = 0;
   if (pZip->m_total_files) {
@@ -3806,15 +3859,49 @@ mz_bool mz_zip_writer_finalize_archive(mz_zip_archive *pZip) {
     pZip->m_archive_size += central_dir_size;
   }
 
+  // Write the zip64 end of central directory record and locator, only if the
+  // values do not fit in the end of central directory record
+  if ((pZip->m_total_files >= MZ_UINT16_MAX) ||
+      (central_dir_size >= MZ_UINT32_MAX) ||
+      (central_dir_ofs >= MZ_UINT32_MAX)) {
+    mz_uint8 *pLoc = hdr64 + MZ_ZIP64_END_OF_CENTRAL_DIR_HEADER_SIZE;
+    MZ_CLEAR_OBJ(hdr64);
+    MZ_WRITE_LE32(hdr64 + MZ_ZIP64_ECDH_SIG_OFS,
+                  MZ_ZIP64_END_OF_CENTRAL_DIR_HEADER_SIG);
+    MZ_WRITE_LE64(hdr64 + MZ_ZIP64_ECDH_SIZE_OF_RECORD_OFS,
+                  MZ_ZIP64_END_OF_CENTRAL_DIR_HEADER_SIZE - 12);
+    MZ_WRITE_LE16(hdr64 + MZ_ZIP64_ECDH_VERSION_MADE_BY_OFS,
+                  (10 * MZ_VER_MAJOR + MZ_VER_MINOR) | (MZ_PLATFORM << 8));
+    MZ_WRITE_LE16(hdr64 + MZ_ZIP64_ECDH_VERSION_NEEDED_OFS, 45);
+    MZ_WRITE_LE64(hdr64 + MZ_ZIP64_ECDH_CDIR_NUM_ENTRIES_ON_DISK_OFS,
+                  pZip->m_total_files);
+    MZ_WRITE_LE64(hdr64 + MZ_ZIP64_ECDH_CDIR_TOTAL_ENTRIES_OFS,
+                  pZip->m_total_files);
+    MZ_WRITE_LE64(hdr64 + MZ_ZIP64_ECDH_CDIR_SIZE_OFS, central_dir_size);
+    MZ_WRITE_LE64(hdr64 + MZ_ZIP64_ECDH_CDIR_OFS_OFS, central_dir_ofs);
+    MZ_WRITE_LE32(pLoc + MZ_ZIP64_ECDL_SIG_OFS,
+                  MZ_ZIP64_END_OF_CENTRAL_DIR_LOCATOR_SIG);
+    MZ_WRITE_LE64(pLoc + MZ_ZIP64_ECDL_REL_OFS_TO_ZIP64_ECDR_OFS,
+                  pZip->m_archive_size);
+    MZ_WRITE_LE32(pLoc + MZ_ZIP64_ECDL_TOTAL_NUMBER_OF_DISKS_OFS, 1);
+    if (pZip->m_pWrite(pZip->m_pIO_opaque, pZip->m_archive_size, hdr64,
+                       sizeof(hdr64)) != sizeof(hdr64))
+      return MZ_FALSE;
+    pZip->m_archive_size += sizeof(hdr64);
+  }
+
   // Write end of central directory record
   MZ_CLEAR_OBJ(hdr);
   MZ_WRITE_LE32(hdr + MZ_ZIP_ECDH_SIG_OFS,
                 MZ_ZIP_END_OF_CENTRAL_DIR_HEADER_SIG);
   MZ_WRITE_LE16(hdr + MZ_ZIP_ECDH_CDIR_NUM_ENTRIES_ON_DISK_OFS,
-                pZip->m_total_files);
-  MZ_WRITE_LE16(hdr + MZ_ZIP_ECDH_CDIR_TOTAL_ENTRIES_OFS, pZip->m_total_files);
-  MZ_WRITE_LE32(hdr + MZ_ZIP_ECDH_CDIR_SIZE_OFS, central_dir_size);
-  MZ_WRITE_LE32(hdr + MZ_ZIP_ECDH_CDIR_OFS_OFS, central_dir_ofs);
+                MZ_MIN(pZip->m_total_files, MZ_UINT16_MAX));
+  MZ_WRITE_LE16(hdr + MZ_ZIP_ECDH_CDIR_TOTAL_ENTRIES_OFS,
+                MZ_MIN(pZip->m_total_files, MZ_UINT16_MAX));
+  MZ_WRITE_LE32(hdr + MZ_ZIP_ECDH_CDIR_SIZE_OFS,
+                MZ_MIN(central_dir_size, MZ_UINT32_MAX));
+  MZ_WRITE_LE32(hdr + MZ_ZIP_ECDH_CDIR_OFS_OFS,
+                MZ_MIN(central_dir_ofs, MZ_UINT32_MAX));
 
   if (pZip->m_pWrite(pZip->m_pIO_opaque, pZip->m_archive_size, hdr,
                      sizeof(hdr)) != sizeof(hdr))
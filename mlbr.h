@@ -54,6 +54,10 @@
 #define strcasecmp _stricmp
 #define alloca  _alloca
 #define realpath(path, resolved)    _fullpath(resolved, path, 0)
+#define gmtime_r(timer, buf)        (gmtime_s(buf, timer) ? NULL : (buf))
+#define localtime_r(timer, buf)     (localtime_s(buf, timer) ? NULL : (buf))
+#define THREAD_LOCAL    __declspec(thread)
+#define FORCEINLINE     __forceinline
 #else
 #include <unistd.h>
 #include <utime.h>
@@ -66,6 +70,8 @@ char *strlwr(char *str);
 #define _MAX_PATH   PATH_MAX
 #define nameCmp strcmp
 int _vscprintf(const char *fmt, va_list pargs);
+#define THREAD_LOCAL    __thread
+#define FORCEINLINE     inline __attribute__((always_inline))
 #endif
 
 
@@ -83,14 +89,22 @@ enum {
 #define LBRDIR_SIZE 32
 #define LBRSECTOR_SIZE  128
 enum {
-    F_BADCRC = 1, F_NOCRC = 2, F_TRUNCATED = 4       // bit flags
+    F_BADCRC = 1, F_NOCRC = 2, F_TRUNCATED = 4, F_SPILLFAIL = 8 // bit flags
 };
 
 enum {
-    LISTONLY = 0, EXTRACT = 1, SUBDIR = 2, ZIP = 4, Z7 = 8, SAVEMASK = 0xf,
+    LISTONLY = 0, EXTRACT = 1, SUBDIR = 2, ZIP = 4, TGZ = 8, SAVEMASK = 0xf,
     FORCE = 16, RECURSE = 32, KEEPCASE = 64, NOEXPAND = 128
 };
 
+enum {      // check value accumulated on the output, see startCheck
+    CHK_NONE = 0, CHK_SUM, CHK_CRC16
+};
+
+enum {      // where decoded output goes once it outgrows its buffer, see outU8
+    SINK_MEMORY = 0, SINK_SPILL, SINK_DISCARD
+};
+
 enum {      // return results from decompression functions
     BADHEADER = -2, CORRUPT = -1 , BADCRC = 0, GOOD = 1
 };
@@ -102,6 +116,11 @@ enum {      // return results from decompression functions
 
 extern bool ignoreCrc;
 extern bool ignoreCorrupt;
+extern int lbrThreads;
+extern int zipLevel;
+extern bool asyncIo;
+extern bool streamOut;
+extern char const *spillDir;
 
 #define MINALLOC   1024
 typedef struct {
@@ -110,6 +129,9 @@ typedef struct {
     time_t fdate;
     char const *fname;
     uint8_t *buf;
+    bool mapped; // buf is a read only mapping of the file, for content->out the spill file
+    FILE *fp;    // a loaded file is kept open, so stored members can be copied from it
+                 // for content->out, the spill file whilst the output is written to it
 } file_t;
 
 typedef struct _content {
@@ -117,8 +139,16 @@ typedef struct _content {
     struct _content *lbrHead;
     uint16_t status;
     uint8_t type;
-    uint8_t bitCount;
-    unsigned bitStream;
+    uint8_t bitCount;       // bits held in bitStream
+    uint64_t bitStream;
+    bool repeatFlag;        // rle state, kept per file so decoders are reentrant
+    uint8_t lastCh;
+    uint8_t check;          // type of check value accumulated on the output
+    uint16_t checkVal;      // value so far, covering the output up to checkPos
+    long checkPos;
+    uint8_t sink;           // where output that does not fit in out.buf goes
+    long outBase;           // output position of out.buf[0], non zero once output has gone
+    int lbrCrc;             // library member CRC still to be verified, -1 if none
     int length;             // this is the expected input length, in.bufSize is actual length
     char const *savePath;   // name file is saved as including directory prefix
     char *msg;
@@ -132,12 +162,120 @@ enum {
     CrLzh, CrLzhV1, CrLzhV2, Library, Skipped, Missing, Mapping
 };
 
+/*
+    bit readers, MSB first for crunch and cr-lzh, LSB first for squeeze
+    bitStream is refilled with as many whole bytes as will fit, with a single bounds check
+    for MSB first the next bit is bit bitCount - 1, for LSB first it is bit 0
+    endBits returns any unused whole bytes so byte reads can follow
+*/
+static inline void fillBits(content_t *content) {
+    long n = (63 - content->bitCount) / 8;
+    if (n > content->in.bufSize - content->in.pos) {
+        n = content->in.bufSize - content->in.pos;
+    }
+    uint8_t const *s = content->in.buf + content->in.pos;
+    for (long i = 0; i < n; i++) {
+        content->bitStream = (content->bitStream << 8) | s[i];
+    }
+    content->in.pos += n;
+    content->bitCount += (uint8_t)(n * 8);
+}
+
+static inline void fillBitsRev(content_t *content) {
+    long n = (63 - content->bitCount) / 8;
+    if (n > content->in.bufSize - content->in.pos) {
+        n = content->in.bufSize - content->in.pos;
+    }
+    uint8_t const *s = content->in.buf + content->in.pos;
+    for (long i = 0; i < n; i++) {
+        content->bitStream |= (uint64_t)s[i] << (content->bitCount + i * 8);
+    }
+    content->in.pos += n;
+    content->bitCount += (uint8_t)(n * 8);
+}
+
+// returns the next count bits or EOF if there are not enough
+static inline int inBits(content_t *content, uint8_t count) {
+    if (count > content->bitCount) {
+        fillBits(content);
+        if (count > content->bitCount) {
+            return EOF;
+        }
+    }
+    content->bitCount -= count;
+    return (int)(content->bitStream >> content->bitCount) & ~(~0U << count);
+}
+
+static inline int inBitRev(content_t *content) {
+    if (content->bitCount == 0) {
+        fillBitsRev(content);
+        if (content->bitCount == 0) {
+            return EOF;
+        }
+    }
+    int bit = content->bitStream & 1;
+    content->bitStream >>= 1;
+    content->bitCount--;
+    return bit;
+}
+
+// returns the next count bits without using them, bits past the end of the data are 0
+// the caller should use bitCount to check that enough bits are available
+static inline int peekBitsRev(content_t *content, uint8_t count) {
+    if (count > content->bitCount) {
+        fillBitsRev(content);
+    }
+    return (int)content->bitStream & ~(~0U << count);
+}
+
+static inline void skipBitsRev(content_t *content, uint8_t count) {
+    content->bitStream >>= count;
+    content->bitCount -= count;
+}
+
+// bits not yet used, including those in bytes still to be read
+static inline long bitsLeft(content_t const *content) {
+    return (content->in.bufSize - content->in.pos) * 8 + content->bitCount;
+}
+
+void initCrc();
 uint16_t crc16(uint8_t const *data, long len);
+uint16_t crc16Update(uint16_t crc, uint8_t const *data, long len);
 
 uint16_t crc(uint8_t const *data, long len);
+uint16_t crcUpdate(uint16_t crc, uint8_t const *data, long len);
+uint32_t crc32Update(uint32_t crc, uint8_t const *data, long len);
+uint32_t crc32Combine(uint32_t crc1, uint32_t crc2, long len2);
 
 time_t getFileTime(FILE *fp);
 void setFileTime(char const *path, time_t ftime);
+uint8_t *mapFile(FILE *fp, long size);
+void unmapFile(uint8_t *buf, long size);
+long copyRange(FILE *src, long offset, long len, FILE *dst);
+
+// a directory that files are created in, without resolving its path for each file
+#ifdef _WIN32
+typedef char const *dir_t; // no *at functions, so held as its path
+#define NODIR NULL
+#else
+typedef int dir_t; // an open directory
+#define NODIR (-1)
+#endif
+dir_t openDir(dir_t parent, char const *name, bool create);
+void closeDir(dir_t dir);
+void setDirTime(dir_t dir, time_t ftime);
+FILE *createFile(dir_t dir, char const *name);
+bool removeFile(dir_t dir, char const *name);
+void setOpenFileTime(FILE *fp, time_t ftime);
+void prefetchFile(char const *fname);
+FILE *tempFile(char const *dir);
+
+typedef struct _asyncWrites asyncWrites_t; // -a batched writes, see uring.c
+asyncWrites_t *startAsyncWrites();
+void asyncWrite(asyncWrites_t *aw, dir_t dir, char const *name, content_t const *content);
+void flushAsyncWrites(asyncWrites_t *aw);
+void asyncDir(asyncWrites_t *aw, dir_t dir, time_t fdate);
+bool endAsyncWrites(asyncWrites_t *aw);
 
 
 
@@ -166,19 +304,25 @@ const char *uniqueName(char const *subDir, char const *fname);
 
 file_t *loadFile(char const *name);
 content_t *makeDescriptor(file_t const *file, char const *name, uint8_t *start, long length);
-bool saveContent(content_t const *content, char const *targetDir);
+bool saveContent(content_t const *content, char const *targetDir, file_t const *src);
+void saveMsg(content_t const *content, char const *err);
 void freeAllDescriptors(content_t *content);
+long outLength(content_t const *content);
 void outU8(uint8_t c, content_t *content);
+void endOutput(content_t *content);
 void outStr(content_t *content, char const *fmt, ...);
 void outRle(int val, content_t *content);
+void updateCheck(content_t *content);
+void startCheck(content_t *content, int check);
+uint16_t endCheck(content_t *content);
+void chkLbrCrc(content_t *content);
 bool isEof(content_t const *content);
 int inU8(content_t *content);
 int inU16(content_t *content);
 int inI16(content_t *content);
 int u16At(uint8_t const *buf, long offset);
 bool inSeek(content_t *content, long offset);
-int inBits(content_t *content, uint8_t count);
-int inBitRev(content_t *content);
+void endBits(content_t *content);
 void unloadFile(file_t *file);
 void setStoreFile(content_t *content);
 
@@ -189,7 +333,24 @@ bool parseHeader(content_t *content);
 bool mkPath(char const *dir);
 void usage(char const *fmt, ...);
 char *mapCase(char *s);
-bool saveZip(content_t *content, char const *targetDir, char const *zipfile);
+typedef struct _zipEntries zipEntries_t; // a file's zip entries, compressed ready to write
+bool saveZip(zipEntries_t *entries, char const *targetDir, char const *zipfile);
+bool openZip(char const *targetDir, char const *zipfile, bool update);
+char *zipSourceName(char const *fname);
+bool zipUnchanged(char const *source);
+char const *zipTopDir(char const *source, char const *name);
+zipEntries_t *deflateZip(content_t *content, char const *source, char const *topDir);
+bool addZip(zipEntries_t *entries);
+long zipEntriesSize(zipEntries_t const *entries);
+bool closeZip();
+typedef struct _tarData tarData_t; // a file's tar.gz data, compressed ready to write
+tarData_t *deflateTar(content_t *content);
+long tarDataSize(tarData_t const *data);
+bool saveTar(tarData_t *data, char const *targetDir, char const *tarfile);
+bool openTar(char const *targetDir, char const *tarfile);
+char const *tarTopDir(char const *name);
+bool addTar(content_t *content, char const *topDir);
+bool closeTar();
 char *replaceExt(char const *name, char const *ext);
 char const *nameOnly(char const *fname);
 void protectSrc(const char *fname, const char *target);
@@ -197,8 +358,32 @@ void freeHashTable();
 bool chkClash(char const *fname);
 void displayDate(time_t date);
 void logErr(content_t *content, char const *fmt, ...);
+void msgPrintf(char const *fmt, ...);
+void msgPutc(int c);
+void bufferMsgs(bool on);
+char *takeMsgs();
+void flushMsgs(bool discard);
+void msgStream(FILE *fp);
 char const *concat(const char *s, ...);
 char const *makeFullPath(const char *targetDir, const char *fname);
+// minimal thread support for batch mode, see os.c
+typedef struct _thread thread_t;
+typedef struct _monitor monitor_t; // mutex with an associated condition variable
+
+thread_t *startThread(void (*fn)(void *), void *arg);
+void joinThread(thread_t *thread);
+monitor_t *newMonitor();
+void freeMonitor(monitor_t *monitor);
+void enterMonitor(monitor_t *monitor);
+void exitMonitor(monitor_t *monitor);
+void waitMonitor(monitor_t *monitor);
+void notifyMonitor(monitor_t *monitor);
+int cpuCount();
+void *sPool();
+void sSharePool(void *pool, monitor_t *lock);
+void *sNewPool();
+void sFreePool(void *pool);
+
 #ifdef _DEBUG
 void xfree(void *p);
 #else
@@ -28,26 +28,39 @@
 /*
     They functions here fall into the following groups
     file timestamps
+    file mapping
     directory management
+    directory relative files
     filename management
+    threads
     misc OS missing functions
 */
 
+#ifdef __linux__
+#define _GNU_SOURCE // for copy_file_range
+#endif
 #include "mlbr.h"
 #ifdef _WIN32
 #define WINDOWS_LEAN_AND_MEAN
 #include <Windows.h>
+#include <io.h>
 #else
 #include <stdarg.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <errno.h>
 #endif
 
 time_t getFileTime(FILE *fp) {
     struct stat buf;
 
+    struct tm tmbuf;
+
     if (fstat(fileno(fp), &buf) != 0) {
         return 0;
     }
-    return timegm(localtime(&buf.st_mtime));
+    return timegm(localtime_r(&buf.st_mtime, &tmbuf));
 }
 
 #ifdef _WIN32
@@ -84,6 +97,119 @@ void setFileTime(char const *path, time_t ftime) {
 }
 #endif
 
+// map size bytes of the open file fp into memory as read only
+// returns NULL if the file cannot be mapped e.g. it is empty, the caller should then read it
+#ifdef _WIN32
+uint8_t *mapFile(FILE *fp, long size) {
+    if (size <= 0) {
+        return NULL;
+    }
+    HANDLE hMap = CreateFileMapping((HANDLE)_get_osfhandle(_fileno(fp)), NULL, PAGE_READONLY, 0,
+                                    0, NULL);
+    if (hMap == NULL) {
+        return NULL;
+    }
+    uint8_t *buf = MapViewOfFile(hMap, FILE_MAP_READ, 0, 0, (size_t)size);
+    CloseHandle(hMap); // the view keeps the mapping open
+    return buf;
+}
+
+void unmapFile(uint8_t *buf, long size) {
+    UnmapViewOfFile(buf);
+}
+#else
+uint8_t *mapFile(FILE *fp, long size) {
+    if (size <= 0) {
+        return NULL;
+    }
+    void *buf = mmap(NULL, (size_t)size, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+    if (buf == MAP_FAILED) {
+        return NULL;
+    }
+    // members of a library are decoded in directory order or in parallel, so rather
+    // than sequential read ahead, ask for the whole file to be read in
+    // unless with -s the file may be too big for that
+    madvise(buf, (size_t)size, streamOut ? MADV_SEQUENTIAL : MADV_WILLNEED);
+    return buf;
+}
+
+void unmapFile(uint8_t *buf, long size) {
+    munmap(buf, (size_t)size);
+}
+#endif
+
+// copy len bytes at offset in src to dst, which has not been written to, without them
+// passing through memory. On file systems that support it the data is shared rather
+// than copied. Returns the number of bytes copied, dst is left positioned after them
+// and any remainder should be written as normal
+#ifdef __linux__
+long copyRange(FILE *src, long offset, long len, FILE *dst) {
+    loff_t srcOffset = offset;
+    long copied      = 0;
+    while (copied < len) {
+        ssize_t n = copy_file_range(fileno(src), &srcOffset, fileno(dst), NULL,
+                                    (size_t)(len - copied), 0);
+        if (n <= 0) { // not supported, e.g. across file systems
+            break;
+        }
+        copied += (long)n;
+    }
+    if (copied) {
+        fseek(dst, copied, SEEK_SET); // keep stdio's position in step with the file's
+    }
+    return copied;
+}
+#else
+long copyRange(FILE *src, long offset, long len, FILE *dst) {
+    return 0;
+}
+#endif
+
+// creates a temporary file in dir, which is deleted once it is closed and unmapped
+#ifdef _WIN32
+FILE *tempFile(char const *dir) {
+    char path[MAX_PATH];
+    if (GetTempFileNameA(dir, "mlb", 0, path) == 0) {
+        return NULL;
+    }
+    return fopen(path, "w+bD"); // D deletes the file when it is closed
+}
+#else
+FILE *tempFile(char const *dir) {
+    int fd = -1;
+#ifdef O_TMPFILE
+    fd = open(dir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600); // never has a name
+#endif
+    if (fd < 0) { // not supported by the file system
+        char *path = xmalloc(strlen(dir) + sizeof("/mlbrXXXXXX"));
+        strcat(strcpy(path, dir), "/mlbrXXXXXX");
+        if ((fd = mkstemp(path)) >= 0) {
+            unlink(path);
+        }
+        xfree(path);
+    }
+    FILE *fp = fd >= 0 ? fdopen(fd, "w+b") : NULL;
+    if (fd >= 0 && !fp) {
+        close(fd);
+    }
+    return fp;
+}
+#endif
+
+// hint that fname will be read soon, so the system can start reading it in the background
+#ifdef POSIX_FADV_WILLNEED
+void prefetchFile(char const *fname) {
+    int fd = open(fname, O_RDONLY);
+    if (fd >= 0) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+        close(fd);
+    }
+}
+#else
+void prefetchFile(char const *fname) {
+}
+#endif
+
 // utility to create dir if necessary
 // returns false if name is already used but not a dir
 // or cannot create dir otherwise returns true
@@ -148,6 +274,82 @@ static bool chkReserved(char const *fn) {
 }
 #endif
 
+/*
+    extraction creates files and sub directories relative to an open directory, so
+    the kernel does not have to look up the whole path again for each file and
+    timestamps are set on the open file rather than by path
+    windows has no equivalent, so there a directory is held as its path
+    parent NODIR opens name as a path, create makes the directory if necessary
+*/
+#ifdef _WIN32
+dir_t openDir(dir_t parent, char const *name, bool create) {
+    char const *path = parent ? makeFullPath(parent, name) : name;
+    return !create || safeMkdir(path) ? path : NODIR;
+}
+
+void closeDir(dir_t dir) {
+}
+
+void setDirTime(dir_t dir, time_t ftime) {
+    setFileTime(dir, ftime);
+}
+
+FILE *createFile(dir_t dir, char const *name) {
+    return fopen(makeFullPath(dir, name), "wb");
+}
+
+bool removeFile(dir_t dir, char const *name) {
+    return unlink(makeFullPath(dir, name)) == 0;
+}
+
+// as for setFileTime the create time is also set
+void setOpenFileTime(FILE *fp, time_t ftime) {
+    ULARGE_INTEGER hiresTime = { .QuadPart = unixDay0 + (uint64_t)ftime * 10000000ULL };
+    FILETIME filetm          = { hiresTime.LowPart, hiresTime.HighPart };
+    fflush(fp); // a later flush would update the time
+    SetFileTime((HANDLE)_get_osfhandle(_fileno(fp)), &filetm, &filetm, &filetm);
+}
+#else
+dir_t openDir(dir_t parent, char const *name, bool create) {
+    int at = parent == NODIR ? AT_FDCWD : parent;
+    if (create && mkdirat(at, name, 0774) != 0 && errno != EEXIST) {
+        return NODIR;
+    }
+    return openat(at, name, O_RDONLY | O_DIRECTORY); // fails if name is not a directory
+}
+
+void closeDir(dir_t dir) {
+    close(dir);
+}
+
+void setDirTime(dir_t dir, time_t ftime) {
+    struct timespec times[2] = { { ftime, 0 }, { ftime, 0 } };
+    futimens(dir, times);
+}
+
+FILE *createFile(dir_t dir, char const *name) {
+    int fd = openat(dir, name, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    FILE *fp;
+    if (fd < 0) {
+        return NULL;
+    }
+    if (!(fp = fdopen(fd, "wb"))) {
+        close(fd);
+    }
+    return fp;
+}
+
+bool removeFile(dir_t dir, char const *name) {
+    return unlinkat(dir, name, 0) == 0;
+}
+
+void setOpenFileTime(FILE *fp, time_t ftime) {
+    struct timespec times[2] = { { ftime, 0 }, { ftime, 0 } };
+    fflush(fp); // a later flush would update the time
+    futimens(fileno(fp), times);
+}
+#endif
+
 // fin an os safe file name to store the file
 // if the original filename is safe it will be used unless there is a clash with other names for
 // example
@@ -244,7 +446,15 @@ char const *nameOnly(char const *fname) {
     return fname;
 }
 
+// returns the path of fname in targetDir, an absolute fname is returned as is
 char const *makeFullPath(const char *targetDir, const char *fname) {
+#ifdef _WIN32
+    if (ISDIRSEP(fname[0]) || (isalpha(fname[0]) && fname[1] == ':')) {
+#else
+    if (ISDIRSEP(fname[0])) {
+#endif
+        return fname; // already absolute
+    }
     const char *s = strchr(targetDir, '\0');
     if (s != targetDir &&
         ISDIRSEP(s[-1])) { // avoid separator if not needed should only happen for root
@@ -253,6 +463,148 @@ char const *makeFullPath(const char *targetDir, const char *fname) {
     return concat(targetDir, OSDIRSEP, fname, NULL);
 }
 
+/*
+    minimal thread support used by batch mode
+    a monitor is a mutex with an associated condition variable
+    waitMonitor must be called with the monitor entered
+*/
+#ifdef _WIN32
+struct _thread {
+    HANDLE handle;
+    void (*fn)(void *);
+    void *arg;
+};
+
+struct _monitor {
+    CRITICAL_SECTION cs;
+    CONDITION_VARIABLE cv;
+};
+
+static DWORD WINAPI threadStub(LPVOID param) {
+    thread_t *thread = param;
+    thread->fn(thread->arg);
+    return 0;
+}
+
+thread_t *startThread(void (*fn)(void *), void *arg) {
+    thread_t *thread = xmalloc(sizeof(thread_t));
+    thread->fn       = fn;
+    thread->arg      = arg;
+    if ((thread->handle = CreateThread(NULL, 0, threadStub, thread, 0, NULL)) == NULL) {
+        fprintf(stderr, "Fatal Error: cannot create thread\n");
+        exit(1);
+    }
+    return thread;
+}
+
+void joinThread(thread_t *thread) {
+    WaitForSingleObject(thread->handle, INFINITE);
+    CloseHandle(thread->handle);
+    xfree(thread);
+}
+
+monitor_t *newMonitor() {
+    monitor_t *monitor = xmalloc(sizeof(monitor_t));
+    InitializeCriticalSection(&monitor->cs);
+    InitializeConditionVariable(&monitor->cv);
+    return monitor;
+}
+
+void freeMonitor(monitor_t *monitor) {
+    DeleteCriticalSection(&monitor->cs);
+    xfree(monitor);
+}
+
+void enterMonitor(monitor_t *monitor) {
+    EnterCriticalSection(&monitor->cs);
+}
+
+void exitMonitor(monitor_t *monitor) {
+    LeaveCriticalSection(&monitor->cs);
+}
+
+void waitMonitor(monitor_t *monitor) {
+    SleepConditionVariableCS(&monitor->cv, &monitor->cs, INFINITE);
+}
+
+void notifyMonitor(monitor_t *monitor) {
+    WakeAllConditionVariable(&monitor->cv);
+}
+
+int cpuCount() {
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors;
+}
+#else
+struct _thread {
+    pthread_t id;
+    void (*fn)(void *);
+    void *arg;
+};
+
+struct _monitor {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+};
+
+static void *threadStub(void *param) {
+    thread_t *thread = param;
+    thread->fn(thread->arg);
+    return NULL;
+}
+
+thread_t *startThread(void (*fn)(void *), void *arg) {
+    thread_t *thread = xmalloc(sizeof(thread_t));
+    thread->fn       = fn;
+    thread->arg      = arg;
+    if (pthread_create(&thread->id, NULL, threadStub, thread) != 0) {
+        fprintf(stderr, "Fatal Error: cannot create thread\n");
+        exit(1);
+    }
+    return thread;
+}
+
+void joinThread(thread_t *thread) {
+    pthread_join(thread->id, NULL);
+    xfree(thread);
+}
+
+monitor_t *newMonitor() {
+    monitor_t *monitor = xmalloc(sizeof(monitor_t));
+    pthread_mutex_init(&monitor->mutex, NULL);
+    pthread_cond_init(&monitor->cond, NULL);
+    return monitor;
+}
+
+void freeMonitor(monitor_t *monitor) {
+    pthread_cond_destroy(&monitor->cond);
+    pthread_mutex_destroy(&monitor->mutex);
+    xfree(monitor);
+}
+
+void enterMonitor(monitor_t *monitor) {
+    pthread_mutex_lock(&monitor->mutex);
+}
+
+void exitMonitor(monitor_t *monitor) {
+    pthread_mutex_unlock(&monitor->mutex);
+}
+
+void waitMonitor(monitor_t *monitor) {
+    pthread_cond_wait(&monitor->cond, &monitor->mutex);
+}
+
+void notifyMonitor(monitor_t *monitor) {
+    pthread_cond_broadcast(&monitor->cond);
+}
+
+int cpuCount() {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+}
+#endif
+
 // gcc does not have strlwr
 #ifndef _MSC_VER
 char *strlwr(char *str) {
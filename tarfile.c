@@ -0,0 +1,335 @@
+/* mlbr - extract .lbr archives and decompress Squeeze, Crunch (v1 & v2)
+ *        and Cr-Lzh(v1 & v2) files.
+ *	Comments and date stamps are supported as is conversion to .zip file
+ *	Copyright (C) - 2020-2023 Mark Ogden
+ *
+ * tarfile.c - solid .tar.gz output
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "mlbr.h"
+#define MINIZ_HEADER_FILE_ONLY
+#include "miniz.h"
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+/*
+    the content is written as a POSIX ustar archive, compressed as a single deflate
+    stream in gzip format. Unlike a zip file, where each entry is compressed on its own,
+    the many small and similar files of a library can share the one dictionary
+    the output is written sequentially, so it can go to a pipe, or with -t to memory
+    so that it can be compressed by one thread and written by another
+*/
+#define BLOCKSIZE 512
+
+typedef struct {
+    FILE *fp;      // NULL if the output goes to buf
+    uint8_t *buf;
+    size_t len;
+    size_t bufSize;
+    tdefl_compressor *comp;
+    uint32_t crc;  // crc32 and size modulo 2^32 of the tar data, for the gzip trailer
+    uint32_t size;
+    bool ok;
+} tgz_t;
+
+// ustar header, all numeric fields are octal strings
+typedef struct {
+    char name[100];
+    char mode[8];
+    char uid[8];
+    char gid[8];
+    char size[12];
+    char mtime[12];
+    char chksum[8];
+    char typeflag;
+    char linkname[100];
+    char magic[6];
+    char version[2];
+    char uname[32];
+    char gname[32];
+    char devmajor[8];
+    char devminor[8];
+    char prefix[155];
+    char pad[12];
+} tarHeader_t;
+
+struct _tarData {
+    uint8_t *buf;
+    size_t len;
+    time_t fdate;
+    bool ok;
+};
+
+static mz_bool putBuf(const void *buf, int len, void *user) {
+    tgz_t *t = user;
+    if (t->fp) {
+        return fwrite(buf, 1, len, t->fp) == (size_t)len;
+    }
+    if (t->len + len > t->bufSize) {
+        while (t->len + len > t->bufSize) {
+            t->bufSize = t->bufSize ? t->bufSize * 2 : 0x10000;
+        }
+        t->buf = xrealloc(t->buf, t->bufSize);
+    }
+    memcpy(t->buf + t->len, buf, len);
+    t->len += len;
+    return true;
+}
+
+static bool tgzOpen(tgz_t *t, FILE *fp) {
+    // gzip header: deflate, no flags or time, unknown OS
+    static uint8_t const header[10] = { 0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 0xff };
+
+    *t = (tgz_t){ .fp = fp, .comp = xmalloc(sizeof(tdefl_compressor)), .ok = true };
+    if (tdefl_init(t->comp, putBuf, t,
+                   (int)tdefl_create_comp_flags_from_zip_params(zipLevel, -15,
+                                                                MZ_DEFAULT_STRATEGY)) !=
+        TDEFL_STATUS_OKAY) {
+        t->ok = false;
+    }
+    t->ok = t->ok && putBuf(header, sizeof(header), t);
+    return t->ok;
+}
+
+static bool tgzWrite(tgz_t *t, void const *buf, size_t len) {
+    if (t->ok && len) {
+        t->crc  = crc32Update(t->crc, buf, (long)len);
+        t->size += (uint32_t)len;
+        tdefl_status status = tdefl_compress_buffer(t->comp, buf, len, TDEFL_NO_FLUSH);
+        t->ok               = status == TDEFL_STATUS_OKAY || status == TDEFL_STATUS_DONE;
+    }
+    return t->ok;
+}
+
+// pad the tar data to a whole block
+static bool tgzPad(tgz_t *t, size_t len) {
+    static uint8_t const zeros[BLOCKSIZE];
+    return len % BLOCKSIZE == 0 || tgzWrite(t, zeros, BLOCKSIZE - len % BLOCKSIZE);
+}
+
+// ends the tar archive and the gzip stream, the file itself is left open
+static bool tgzClose(tgz_t *t) {
+    static uint8_t const zeros[2 * BLOCKSIZE]; // end of archive marker
+    uint8_t trailer[8];
+
+    if (tgzWrite(t, zeros, sizeof(zeros))) {
+        tdefl_status status = tdefl_compress_buffer(t->comp, "", 0, TDEFL_FINISH);
+        t->ok               = status == TDEFL_STATUS_DONE;
+    }
+    for (int i = 0; i < 4; i++) {
+        trailer[i]     = (uint8_t)(t->crc >> (i * 8));
+        trailer[i + 4] = (uint8_t)(t->size >> (i * 8));
+    }
+    t->ok = t->ok && putBuf(trailer, sizeof(trailer), t);
+    xfree(t->comp);
+    t->comp = NULL;
+    return t->ok;
+}
+
+// fill all but the last byte of a field with value in octal, the last byte is the '\0'
+static void octal(char *field, size_t size, uint64_t value) {
+    field[--size] = '\0';
+    while (size--) {
+        field[size] = '0' + (value & 7);
+        value >>= 3;
+    }
+}
+
+// writes the header of an entry, a path that does not fit is split into prefix and name
+static bool tarHeader(tgz_t *t, char const *path, char type, long size, time_t mtime) {
+    tarHeader_t h = { 0 };
+    size_t len    = strlen(path);
+    char const *s = path;
+
+    if (len > sizeof(h.name)) {
+        // the split has to be at a / with the prefix and name both fitting
+        for (s = path + len - sizeof(h.name) - 1; *s && *s != '/'; s++)
+            ;
+        if (!*s || (size_t)(s - path) > sizeof(h.prefix)) {
+            return false;
+        }
+        memcpy(h.prefix, path, s++ - path);
+    }
+    memcpy(h.name, s, strlen(s));
+    octal(h.mode, sizeof(h.mode), type == '5' ? 0755 : 0644);
+    octal(h.uid, sizeof(h.uid), 0);
+    octal(h.gid, sizeof(h.gid), 0);
+    octal(h.size, sizeof(h.size), (uint64_t)size);
+    octal(h.mtime, sizeof(h.mtime), mtime > 0 ? (uint64_t)mtime : 0);
+    h.typeflag = type;
+    memcpy(h.magic, "ustar", 6);
+    memcpy(h.version, "00", 2);
+
+    memset(h.chksum, ' ', sizeof(h.chksum)); // checksum is calculated with chksum as spaces
+    unsigned chksum = 0;
+    for (size_t i = 0; i < sizeof(h); i++) {
+        chksum += ((uint8_t *)&h)[i];
+    }
+    octal(h.chksum, sizeof(h.chksum) - 1, chksum); // six digits, '\0' and a space
+    return tgzWrite(t, &h, sizeof(h));
+}
+
+// write the content, including that of nested libraries
+// if topDir is not NULL the names were made under it and the entries are saved under its
+// last component
+static bool tarContent(tgz_t *t, content_t *content, char const *topDir) {
+    bool ok = true;
+    for (content_t *p = content; p; p = p->next) {
+        if (p->type == Library) {
+            ok = tarContent(t, p->lbrHead, topDir) && ok;
+        }
+        if (p->type == Skipped || p->type == Library || p->type == Missing) {
+            continue;
+        }
+        // as for zip files, paths use / and the initial directory is ignored
+#ifdef _WIN32
+        for (char *s = strchr(p->savePath, '\\'); s; s = strchr(s, '\\')) {
+            *s = '/';
+        }
+#endif
+        char const *name = topDir ? p->savePath + strlen(topDir) + 1 : p->savePath;
+        char const *path = strchr(name, '/');
+        path             = path ? path + 1 : name;
+        if (topDir) {
+            path = concat(nameOnly(topDir), "/", path, NULL);
+        }
+        long len        = outLength(p);
+        char const *err = "";
+        if (!tarHeader(t, path, '0', len, p->out.fdate)) {
+            err = t->ok ? " - name too long" : " - failed to write";
+            ok  = false;
+        } else if (!tgzWrite(t, p->out.buf, (size_t)len) || !tgzPad(t, (size_t)len)) {
+            err = " - failed to write";
+            ok  = false;
+        }
+        if (nameCmp(nameOnly(path), p->out.fname) != 0) {
+            msgPrintf("%s -> %s%s\n", p->out.fname, path, err);
+        } else if (*err) {
+            msgPrintf("%s%s\n", path, err);
+        }
+    }
+    return ok;
+}
+
+// compress the content to memory, ready to be written by saveTar
+tarData_t *deflateTar(content_t *content) {
+    tgz_t t;
+    tarData_t *data = xmalloc(sizeof(tarData_t));
+
+    bool ok = tgzOpen(&t, NULL);
+    ok      = tarContent(&t, content, NULL) && ok;
+    ok      = tgzClose(&t) && ok;
+    *data   = (tarData_t){ t.buf, t.len, content->in.fdate, ok };
+    return data;
+}
+
+// memory held by the data from deflateTar
+long tarDataSize(tarData_t const *data) {
+    return (long)data->len;
+}
+
+// write the data from deflateTar to its own tar file, the data is freed
+bool saveTar(tarData_t *data, char const *targetDir, char const *tarfile) {
+    char const *tarPath = concat(targetDir, OSDIRSEP, tarfile, NULL);
+    FILE *fp            = fopen(tarPath, "wb");
+    bool ok             = data->ok;
+
+    if (fp == NULL) {
+        msgPrintf("%s - cannot create tar file\n", tarPath);
+        ok = false;
+    } else {
+        ok = fwrite(data->buf, 1, data->len, fp) == data->len && ok;
+        ok = fclose(fp) == 0 && ok;
+        setFileTime(tarPath, data->fdate);
+        if (!ok) {
+            msgPrintf("%s - problems processing file, deleting\n", tarPath);
+            unlink(tarPath);
+        }
+    }
+    xfree(data->buf);
+    xfree(data);
+    return ok;
+}
+
+/*
+    with -T the content of every file is added to a single .tar.gz file, each under its
+    own top level directory. As the compression is one stream, addTar does all of it
+    and has to be called in command line order. The file - writes to stdout, in which
+    case the listing goes to stderr
+*/
+static tgz_t sharedTar;
+static char *sharedPath;
+static char *sharedName; // the tar file name, the namespace for the top level directories
+
+bool openTar(char const *targetDir, char const *tarfile) {
+    FILE *fp;
+
+    sharedName = strcpy(xmalloc(strlen(tarfile) + 1), tarfile);
+    if (strcmp(tarfile, "-") == 0) {
+        sharedPath = strcpy(xmalloc(strlen("stdout") + 1), "stdout");
+        fp         = stdout;
+        msgStream(stderr);
+#ifdef _WIN32
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+    } else {
+        char const *tarPath = makeFullPath(targetDir, tarfile);
+        sharedPath          = strcpy(xmalloc(strlen(tarPath) + 1), tarPath); // outlives sFree
+        if ((fp = fopen(sharedPath, "wb")) == NULL) {
+            fprintf(stderr, "%s - cannot create tar file\n", sharedPath);
+            return false;
+        }
+    }
+    if (!tgzOpen(&sharedTar, fp)) {
+        fprintf(stderr, "%s - cannot write tar file\n", sharedPath);
+        return false;
+    }
+    return true;
+}
+
+// the top level directory for a file's content, returned under the tar file's name
+// as the directory the content is named in, so the names are only unique within it
+char const *tarTopDir(char const *name) {
+    return uniqueName(sharedName, name);
+}
+
+bool addTar(content_t *content, char const *topDir) {
+    char const *dir = concat(nameOnly(topDir), "/", NULL);
+    bool ok         = tarHeader(&sharedTar, dir, '5', 0, content->in.fdate);
+    if (!ok) {
+        msgPrintf("%s - failed to add directory\n", dir);
+    }
+    return tarContent(&sharedTar, content, topDir) && ok;
+}
+
+// returns false if the tar file could not be completed
+bool closeTar() {
+    bool ok = tgzClose(&sharedTar);
+    if (sharedTar.fp == stdout) {
+        ok = fflush(stdout) == 0 && ok;
+    } else {
+        ok = fclose(sharedTar.fp) == 0 && ok;
+    }
+    if (!ok) {
+        fprintf(stderr, "%s - problems writing tar file\n", sharedPath);
+    }
+    xfree(sharedName);
+    xfree(sharedPath);
+    return ok;
+}
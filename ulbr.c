@@ -67,7 +67,7 @@ static time_t getLbrTime(uint8_t const *lbrItem) {
 }
 
 static char *getLbrName(uint8_t const *lbrItem) {
-    static char name[13];
+    char name[13];
     char *s = name;
     for (int i = Name; i < Name + 8; i++, s++) {
         if ((*s = lbrItem[i] & 0x7f) == ' ') {
@@ -96,10 +96,16 @@ bool parseLbr(content_t *content) {
 
     uint16_t crc    = u16At(lbrBuf, Crc);
 
-    lbrBuf[Crc]     = 0; // for directories CRC is handled specially (replace CRC with 0)
-    lbrBuf[Crc + 1] = 0;
+    // for directories CRC is handled specially, it is calculated with the CRC as 0
+    // the input may be a read only mapping so the CRC bytes are not modified
+    static uint8_t const zeroCrc[2];
+    uint16_t dirCrc = 0;
+    if (dirSize) {
+        dirCrc = crc16Update(crc16(lbrBuf, Crc), zeroCrc, 2);
+        dirCrc = crc16Update(dirCrc, lbrBuf + Crc + 2, dirSize - Crc - 2);
+    }
 
-    if (crc16(lbrBuf, dirSize) != crc) {
+    if (dirCrc != crc) {
         content->status |= (crc && crc != 0xffff) ? F_BADCRC : F_NOCRC;
         logErr(content, "!! %s library CRC is %s\n", content->in.fname,
                (content->status & F_BADCRC) ? "bad" : "missing");
@@ -119,10 +125,7 @@ bool parseLbr(content_t *content) {
             descriptor->next = content->lbrHead; // insert in chain
             content->lbrHead = descriptor;
 
-            crc              = u16At(lbrBuf + off, Crc);
-            if (crc16(descriptor->in.buf, descriptor->in.bufSize) != crc) {
-                descriptor->status |= (crc && crc != 0xffff) ? F_BADCRC : F_NOCRC;
-            }
+            descriptor->lbrCrc = u16At(lbrBuf + off, Crc); // checked by chkLbrCrc
 
             // pad count adjustment is NOT done since in the files I have seen
             // is isn't reliable and sometimes invalid
@@ -133,3 +136,16 @@ bool parseLbr(content_t *content) {
     // TODO - check if any of the content overlaps - unlikely to be implemented
     return true;
 }
+
+// verify the CRC of a library member
+// this is done just before the member is decoded, rather than when the directory
+// is parsed, so the data is still in cache for the decoder
+void chkLbrCrc(content_t *content) {
+    if (content->lbrCrc >= 0) {
+        uint16_t crc = (uint16_t)content->lbrCrc;
+        if (crc16(content->in.buf, content->in.bufSize) != crc) {
+            content->status |= (crc && crc != 0xffff) ? F_BADCRC : F_NOCRC;
+        }
+        content->lbrCrc = -1;
+    }
+}
@@ -67,24 +67,35 @@
 typedef struct {
     uint16_t predecessor; /*index to previous entry, if any*/
     uint16_t suffix;      /*character suffixed to previous entries*/
+    uint16_t length;      // length of the string for this entry, 0 if not known
 } entry_t;
 
-static entry_t table[TABLE_SIZE];
-
-/*auxilliary physical translation table*/
-/*translates hash to main table index*/
-static uint16_t xlatbl[XLATBL_SIZE];
-
-/*other global variables*/
-static uint8_t codlen;  /*variable code length in bits (9-12)*/
-static uint8_t fulflg;  /*full flag - set once main table is full*/
-static uint16_t entry;  /*next available main table entry*/
-static bool entflg;     /*inhibit main loop from entering this code*/
-static int finchar;     /*first character of last substring output*/
-static uint16_t lastpr; // previous predecessor
-static bool corrupt = false;
-static bool isV2;   // true if V2 of Crunch
-static int endcode; // code to mark end of input stream
+// decoder context, one per call of uncrunch so decodes can run concurrently
+typedef struct {
+    entry_t table[TABLE_SIZE];
+
+    /*auxilliary physical translation table*/
+    /*translates hash to main table index*/
+    uint16_t xlatbl[XLATBL_SIZE];
+
+    uint8_t str[MAXSTR]; // expansion of the current code
+
+    // copy of the initialised tables, restored on an adaptive reset
+    entry_t savedTable[TABLE_SIZE];
+    uint16_t savedXlatbl[XLATBL_SIZE];
+    uint16_t savedEntry;
+    uint8_t savedCodlen;
+    bool saved;
+
+    uint8_t codlen;  /*variable code length in bits (9-12)*/
+    uint8_t fulflg;  /*full flag - set once main table is full*/
+    uint16_t entry;  /*next available main table entry*/
+    bool entflg;     /*inhibit main loop from entering this code*/
+    int finchar;     /*first character of last substring output*/
+    uint16_t lastpr; // previous predecessor
+    bool corrupt;    // set if an over long string is seen
+    int endcode;     // code to mark end of input stream
+} crunch_t;
 
 /*
     Crunch time is stored in 3 fields
@@ -148,7 +159,7 @@ uint16_t hashV2(uint16_t pred, uint16_t suff) {
 
 // hash function for V1
 // generate initial hash, then get new hash value from xlatbl if already inuse
-static uint16_t hashV1(uint16_t pred, uint16_t chr) {
+static uint16_t hashV1(crunch_t *cr, uint16_t pred, uint16_t chr) {
     uint16_t hashval;
     if (pred == IMPRED && chr == 0)
         hashval = 0x800; /* special case (leaving the zero code free for EOF) */
@@ -159,26 +170,26 @@ static uint16_t hashV1(uint16_t pred, uint16_t chr) {
     }
 
     // use link chain to find free slot
-    while (table[hashval].suffix != EMPTY && xlatbl[hashval] != EMPTY) {
-        hashval = xlatbl[hashval];
+    while (cr->table[hashval].suffix != EMPTY && cr->xlatbl[hashval] != EMPTY) {
+        hashval = cr->xlatbl[hashval];
     }
     return hashval;
 }
 
-static uint16_t getInsertPtV1(uint16_t pred, uint8_t chr) {
-    uint16_t hashval = hashV1(pred, chr);
+static uint16_t getInsertPtV1(crunch_t *cr, uint16_t pred, uint8_t chr) {
+    uint16_t hashval = hashV1(cr, pred, chr);
 
     /* make sure we return early if possible to avoid adding link */
-    if (table[hashval].suffix != EMPTY) {
+    if (cr->table[hashval].suffix != EMPTY) {
         // probe for an empty slot starting 101 slots from initial slot
         uint16_t initialHash = hashval;
 
-        for (hashval = (hashval + 101) % TABLE_SIZE; table[hashval].suffix != EMPTY;
+        for (hashval = (hashval + 101) % TABLE_SIZE; cr->table[hashval].suffix != EMPTY;
              hashval = (hashval + 1) % TABLE_SIZE) {
             ;
         }
         // add link to here from the end of the chain
-        xlatbl[initialHash] = hashval;
+        cr->xlatbl[initialHash] = hashval;
     }
     return hashval;
 }
@@ -186,18 +197,38 @@ static uint16_t getInsertPtV1(uint16_t pred, uint8_t chr) {
 // find an empty entry in xlatbl which hashes from this predecessor/suffix
 // combo, and store the index of the next available lzw table entry in it
 // returns entry is always the the insert point into table
-static uint16_t getInsertPtV2(uint16_t pred, uint8_t suff) {
+static uint16_t getInsertPtV2(crunch_t *cr, uint16_t pred, uint8_t suff) {
     uint16_t hashval = hashV2(pred, suff);
     uint16_t rehash;
 
     /*follow secondary hash chain as necessary to find an empty slot*/
-    for (rehash = hashval; xlatbl[rehash] != EMPTY; rehash = (rehash + hashval) % XLATBL_SIZE) {
+    for (rehash = hashval; cr->xlatbl[rehash] != EMPTY;
+         rehash = (rehash + hashval) % XLATBL_SIZE) {
         ;
     }
 
     /*stuff next available index into this slot*/
-    xlatbl[rehash] = entry;
-    return entry;
+    cr->xlatbl[rehash] = cr->entry;
+    return cr->entry;
+}
+
+/*
+    the V1 and V2 decoders share the code below, with the version passed as isV2
+    the hot functions are force inlined, so with isV2 a constant each of uncrunchV1
+    and uncrunchV2 has its own decode loop without the other version's tests
+*/
+
+// record the length of the string for an entry, derived from its predecessor
+// the length is only unknown if the table has been built from corrupt data
+static FORCEINLINE void setString(crunch_t *cr, uint16_t insertPt, uint16_t pred, bool isV2) {
+    entry_t *ep = &cr->table[insertPt];
+    if (isV2 ? insertPt <= 255 : pred >= MAXSTR) { // atomic entry
+        ep->length = 1;
+    } else if (pred < TABLE_SIZE && cr->table[pred].length) {
+        ep->length = cr->table[pred].length + 1;
+    } else {
+        ep->length = 0;
+    }
 }
 
 /*enter the next code into the lzw table*/
@@ -205,119 +236,149 @@ static uint16_t getInsertPtV2(uint16_t pred, uint8_t suff) {
  * means we don't have a real entry, but entry is used to count
  * how many hashs have been created
  */
-static void enterx(uint16_t pred, uint8_t suff) {
-    uint16_t insertPt = isV2 ? getInsertPtV2(pred, suff) : getInsertPtV1(pred, suff);
+static FORCEINLINE void enterx(crunch_t *cr, uint16_t pred, uint8_t suff, bool isV2) {
+    uint16_t insertPt = isV2 ? getInsertPtV2(cr, pred, suff) : getInsertPtV1(cr, pred, suff);
 
     /*make the new entry*/
-    table[insertPt].suffix = suff;
+    cr->table[insertPt].suffix = suff;
     if (isV2 || pred < MAXSTR) {
-        table[insertPt].predecessor = pred;
+        cr->table[insertPt].predecessor = pred;
     }
+    setString(cr, insertPt, pred, isV2);
 
     /*if only one entry of the current code length remains, update to*/
     /*next code length because main loop is reading one code ahead*/
-    if (++entry >= ~(~0U << codlen)) {
-        if (codlen < 12) { // table not full, just make length one more bit
-            codlen++;
+    if (++cr->entry >= ~(~0U << cr->codlen)) {
+        if (cr->codlen < 12) { // table not full, just make length one more bit
+            cr->codlen++;
         } else {      // table almost full (fulflg==0) or full (fulflg==1)
-            fulflg++; // just increment fulflg - when it gets to 2  will never call again
+            cr->fulflg++; // just increment fulflg - when it gets to 2  will never call again
         }
     }
 }
 
 /*initialize the lzw and physical translation tables and key decoder parameters */
-static void initDecoder() {
+static void initDecoder(crunch_t *cr, bool isV2) {
 
-    codlen  = isV2 ? 9 : 12;     // initial code length V1 is always 12
-    fulflg  = 0;                 // flag as empty table
-    entry   = isV2 ? 0 : 1;      // V1 pre allocated entry 0
-    entflg  = true;              // first code is always atomic
-    endcode = isV2 ? EOFCOD : 0; // end of date code
+    cr->codlen  = isV2 ? 9 : 12;     // initial code length V1 is always 12
+    cr->fulflg  = 0;                 // flag as empty table
+    cr->entry   = isV2 ? 0 : 1;      // V1 pre allocated entry 0
+    cr->entflg  = true;              // first code is always atomic
+    cr->endcode = isV2 ? EOFCOD : 0; // end of date code
 
     /*first mark all entries of xlatbl as empty*/
     for (int i = 0; i < XLATBL_SIZE; i++) { // v1 only really needs MAXSTR
-        xlatbl[i] = EMPTY;
+        cr->xlatbl[i] = EMPTY;
     }
 
     for (int i = 0; i < TABLE_SIZE; i++) {
-        table[i].suffix = table[i].predecessor = EMPTY; // v2 only really needs suffix
+        cr->table[i].suffix = cr->table[i].predecessor = EMPTY; // v2 only really needs suffix
+        cr->table[i].length = 0;
     }
 
     if (!isV2) {
-        table[0].predecessor = table[0].suffix = IMPRED; /* reserved */
+        cr->table[0].predecessor = cr->table[0].suffix = IMPRED; /* reserved */
     }
 
     /*enter the 256 atomic into lzw table*/
     for (int i = 0; i < 0x100; i++) {
-        enterx(isV2 ? NOPRED : IMPRED, i);
+        enterx(cr, isV2 ? NOPRED : IMPRED, i, isV2);
     }
     if (isV2) { // enter the 4 reserve codes
         for (int i = 0; i < RESERVEDCODES; i++) {
-            enterx(IMPRED, 0); /*reserved codes*/
+            enterx(cr, IMPRED, 0, true); /*reserved codes*/
         }
     }
 }
 
+// adaptive reset (V2 only), the first initialises the tables in full and saves a copy of them
+// later resets just restore the copy
+static void resetDecoder(crunch_t *cr) {
+    if (!cr->saved) {
+        initDecoder(cr, true);
+        memcpy(cr->savedTable, cr->table, sizeof(cr->table));
+        memcpy(cr->savedXlatbl, cr->xlatbl, sizeof(cr->xlatbl));
+        cr->savedEntry  = cr->entry;
+        cr->savedCodlen = cr->codlen;
+        cr->saved       = true;
+    } else {
+        memcpy(cr->table, cr->savedTable, sizeof(cr->table));
+        memcpy(cr->xlatbl, cr->savedXlatbl, sizeof(cr->xlatbl));
+        cr->codlen = cr->savedCodlen;
+        cr->fulflg = 0;
+        cr->entry  = cr->savedEntry;
+        cr->entflg = true;
+    }
+}
+
 // get the next codlen bits from the input stream
 // for V2 skip the filler codes
 // errors or end codes are seen then return EOF instead
-static int getcode(content_t *content) {
+static FORCEINLINE int getcode(crunch_t *cr, content_t *content, bool isV2) {
     int code;
     do {
-        code = inBits(content, codlen);
+        code = inBits(content, cr->codlen);
     } while (isV2 && (code == NULCOD || code == SPRCOD));
-    return code == endcode ? EOF : code;
+    return code == cr->endcode ? EOF : code;
 }
 
 // emit the byte string for this code
-static bool decode(uint16_t code, content_t *content) {
-    if (table[code].suffix == EMPTY) {
+static FORCEINLINE bool decode(crunch_t *cr, uint16_t code, content_t *content, bool isV2) {
+    if (cr->table[code].suffix == EMPTY) {
         // we need to insert this code before using it
-        entflg = true; // prevent main loop inserting again
-        enterx(lastpr, finchar);
+        cr->entflg = true; // prevent main loop inserting again
+        enterx(cr, cr->lastpr, cr->finchar, isV2);
     }
     if (isV2) {
-        table[code].predecessor |= REFERENCED;
+        cr->table[code].predecessor |= REFERENCED;
     }
 
-    uint8_t stack[MAXSTR];
-    uint8_t *stackp = stack;
-    // pick up the byte string from the tables which are stored in reverse order
-    // V1 uses empty predecessor to note last
-    // V2 uses code in range 0-255
-    while ((!isV2 && table[code].predecessor != EMPTY) || (isV2 && code > 255)) { //-V781
-        *stackp++ = (uint8_t)table[code].suffix;
-        code      = table[code].predecessor % TABLE_SIZE;
-        if (stackp >= &stack[MAXSTR]) {
-            corrupt = true;
-            return (entflg);
+    // the byte string is stored in reverse order in the tables
+    // as its length is known, it is written backwards straight to its place in str
+    int len = cr->table[code].length;
+    if (len == 0) { // table built from corrupt data, so find the length the slow way
+        // V1 uses empty predecessor to note last
+        // V2 uses code in range 0-255
+        uint16_t c = code;
+        while ((!isV2 && cr->table[c].predecessor != EMPTY) || (isV2 && c > 255)) { //-V781
+            c = cr->table[c].predecessor % TABLE_SIZE;
+            if (++len >= MAXSTR) {
+                cr->corrupt = true;
+                return (cr->entflg);
+            }
         }
+        len++;
+    }
+    for (int i = len; --i > 0;) {
+        cr->str[i] = (uint8_t)cr->table[code].suffix;
+        code       = cr->table[code].predecessor % TABLE_SIZE;
     }
 
     // send the first byte and record if for later processing
-    outRle(finchar = table[code].suffix, content);
+    outRle(cr->finchar = cr->table[code].suffix, content);
 
     // emit the rest of the byte string
-    while (stackp > stack) { /*the rest*/
-        outRle(*--stackp, content);
+    for (int i = 1; i < len; i++) {
+        outRle(cr->str[i], content);
     }
 
-    return (entflg);
+    return (cr->entflg);
 }
 
 // attempt to reassign an existing code which has been defined, but never referenced
-static void entfil(uint16_t pred, uint8_t suff) {
+static void entfil(crunch_t *cr, uint16_t pred, uint8_t suff) {
     uint16_t hashval = hashV2(pred, suff);
 
     /*search the candidate codes (all those which hash from this new*/
     /*predecessor and suffix) for an unreferenced one*/
-    for (uint16_t curhash = hashval; xlatbl[curhash] != EMPTY;
+    for (uint16_t curhash = hashval; cr->xlatbl[curhash] != EMPTY;
          curhash          = (curhash + hashval) % XLATBL_SIZE) {
         /*candidate code*/
-        entry_t *ep = table + xlatbl[curhash];
+        entry_t *ep = cr->table + cr->xlatbl[curhash];
         if (!(ep->predecessor & REFERENCED)) { // entry reassignable, so do it!
             ep->predecessor = pred;
             ep->suffix      = suff;
+            setString(cr, (uint16_t)(ep - cr->table), pred, true);
             /*discontinue search*/
             break;
         }
@@ -326,30 +387,42 @@ static void entfil(uint16_t pred, uint8_t suff) {
 
 // this is the main loop to process the crunched data
 
-static bool uncrunchData(content_t *content) {
-    initDecoder();       // set up atomic code definitions etc
-    outRle(-1, content); // reset rle engine
-    corrupt = false;     // no corruption detected yet
+static FORCEINLINE bool uncrunchData(crunch_t *cr, content_t *content, bool isV2) {
+    initDecoder(cr, isV2); // set up atomic code definitions etc
+    outRle(-1, content);   // reset rle engine
+    cr->corrupt = false;   // no corruption detected yet
+    cr->finchar = 0;       // in case a corrupt stream starts with an undefined code
+    cr->saved   = false;   // no copy of the initialised tables yet
 
     int pred;
-    for (lastpr = NOPRED; !corrupt && (pred = getcode(content)) >= 0; lastpr = pred) {
+    for (cr->lastpr = NOPRED; !cr->corrupt && (pred = getcode(cr, content, isV2)) >= 0;
+         cr->lastpr = pred) {
         if (isV2 && pred == RSTCOD) { // reset code
-            initDecoder();
+            resetDecoder(cr);
             pred = NOPRED;
-        } else if (fulflg != 2) { // a normal code room in table
-            if (decode(pred, content) == false) {
-                enterx(lastpr, finchar); // enter code if decode didn't already do so
+        } else if (cr->fulflg != 2) { // a normal code room in table
+            if (decode(cr, pred, content, isV2) == false) {
+                // enter code if decode didn't already do so
+                enterx(cr, cr->lastpr, cr->finchar, isV2);
             } else {
-                entflg = false; // reset the toggle so next enterx works
+                cr->entflg = false; // reset the toggle so next enterx works
             }
         } else { // table is full
-            decode(pred, content);
+            decode(cr, pred, content, isV2);
             if (isV2) { // V2 attempts to reassign
-                entfil(lastpr, finchar);
+                entfil(cr, cr->lastpr, cr->finchar);
             }
         }
     }
-    return !corrupt;
+    return !cr->corrupt;
+}
+
+static bool uncrunchV1(crunch_t *cr, content_t *content) {
+    return uncrunchData(cr, content, false);
+}
+
+static bool uncrunchV2(crunch_t *cr, content_t *content) {
+    return uncrunchData(cr, content, true);
 }
 
 /*uncrunch a single file return true for successful uncrunch */
@@ -372,15 +445,20 @@ int uncrunch(content_t *content) {
 
     // check uncrunch version is supported
     if (siglevel < 0x10 || siglevel > 0x2f) {
-        printf("%s unsupported version of crunch\n", content->in.fname);
+        msgPrintf("%s unsupported version of crunch\n", content->in.fname);
         return BADHEADER;
     }
 
-    isV2          = siglevel >= 0x20; // file global that reflects version of crunch
+    crunch_t *cr  = xmalloc(sizeof(crunch_t)); // decoder tables are too big for the stack
+    bool isV2     = siglevel >= 0x20;          // reflects version of crunch
 
-    content->type = isV2 ? CrunchV2 : CrunchV1; // update the type to reflect we know the version
+    content->type = isV2 ? CrunchV2 : CrunchV1; // update the type to reflect the version
+    startCheck(content, errdetect == 1 ? CHK_CRC16 : errdetect == 0 ? CHK_SUM : CHK_NONE);
 
-    if (!uncrunchData(content)) { // go do the decode
+    bool ok = isV2 ? uncrunchV2(cr, content) : uncrunchV1(cr, content); // go do the decode
+    xfree(cr);
+    endBits(content);
+    if (!ok) {
         return CORRUPT;
     }
 
@@ -390,11 +468,8 @@ int uncrunch(content_t *content) {
         return CORRUPT;
     }
     // tests below will return BADCRC or GOOD
-    if (errdetect == 1) {
-        return crc16(content->out.buf, content->out.pos) == fileCrc;
-    }
-    if (errdetect == 0) {
-        return crc(content->out.buf, content->out.pos) == fileCrc;
+    if (errdetect <= 1) { // crc16 or checksum
+        return endCheck(content) == fileCrc;
     }
     return GOOD;
 }
@@ -0,0 +1,321 @@
+/* mlbr - extract .lbr archives and decompress Squeeze, Crunch (v1 & v2)
+ *        and Cr-Lzh(v1 & v2) files.
+ *	Comments and date stamps are supported as is conversion to .zip file
+ *	Copyright (C) - 2020-2023 Mark Ogden
+ *
+ * uring.c - batched file writes using linux io_uring
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include "mlbr.h"
+
+/*
+    with -a the files of a library are written as a batch, rather than each being
+    opened, written, timestamped and closed by separate system calls
+    the opens of a group of files are queued together, then their writes and then,
+    once each file's time has been set on its descriptor, their closes
+    directories are timestamped and closed once all of the files have been written
+    if io_uring is not available the normal path is used
+    the ring is set up per call of saveContent, so threads do not share one
+*/
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING
+#endif
+#endif
+
+#ifdef HAVE_IO_URING
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#define RINGSIZE 64         // files in each group
+#define MAXWRITE 0x40000000 // largest single write
+
+typedef struct {
+    dir_t dir;
+    char const *name;
+    content_t const *content;
+    int fd;
+    bool created;
+    long done; // bytes written
+    char const *err;
+} asyncFile_t;
+
+typedef struct {
+    dir_t dir;
+    time_t fdate;
+} asyncDir_t;
+
+struct _asyncWrites {
+    int fd; // the ring
+    unsigned *sqHead, *sqTail, *sqMask, *sqArray;
+    unsigned *cqHead, *cqTail, *cqMask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sqRing, *cqRing;
+    size_t sqRingSize, cqRingSize, sqesSize;
+    unsigned queued; // sqes not yet submitted
+    asyncFile_t files[RINGSIZE];
+    int fileCnt;
+    asyncDir_t *dirs;
+    int dirCnt;
+    bool failed; // the ring has failed
+    bool ok;     // all of the files have been written
+};
+
+asyncWrites_t *startAsyncWrites() {
+    struct io_uring_params params = { 0 };
+    asyncWrites_t *aw;
+    int fd = (int)syscall(__NR_io_uring_setup, RINGSIZE, &params);
+
+    if (fd < 0) {
+        return NULL;
+    }
+    // openat and close need 5.6, which also added IORING_FEAT_RW_CUR_POS
+    if (!(params.features & IORING_FEAT_RW_CUR_POS)) {
+        close(fd);
+        return NULL;
+    }
+    aw             = xcalloc(1, sizeof(asyncWrites_t));
+    aw->fd         = fd;
+    aw->ok         = true;
+    aw->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    aw->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    aw->sqesSize   = params.sq_entries * sizeof(struct io_uring_sqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) { // both rings in one mapping
+        if (aw->cqRingSize > aw->sqRingSize) {
+            aw->sqRingSize = aw->cqRingSize;
+        }
+        aw->cqRingSize = 0;
+    }
+    aw->sqRing = mmap(NULL, aw->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      fd, IORING_OFF_SQ_RING);
+    aw->cqRing = aw->cqRingSize == 0 ? aw->sqRing
+                                     : mmap(NULL, aw->cqRingSize, PROT_READ | PROT_WRITE,
+                                            MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    aw->sqes   = mmap(NULL, aw->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                      IORING_OFF_SQES);
+    if (aw->sqRing == MAP_FAILED || aw->cqRing == MAP_FAILED || aw->sqes == MAP_FAILED) {
+        if (aw->sqes != MAP_FAILED) {
+            munmap(aw->sqes, aw->sqesSize);
+        }
+        if (aw->cqRingSize && aw->cqRing != MAP_FAILED) {
+            munmap(aw->cqRing, aw->cqRingSize);
+        }
+        if (aw->sqRing != MAP_FAILED) {
+            munmap(aw->sqRing, aw->sqRingSize);
+        }
+        close(fd);
+        xfree(aw);
+        return NULL;
+    }
+    uint8_t *sq = aw->sqRing;
+    uint8_t *cq = aw->cqRing;
+    aw->sqHead  = (unsigned *)(sq + params.sq_off.head);
+    aw->sqTail  = (unsigned *)(sq + params.sq_off.tail);
+    aw->sqMask  = (unsigned *)(sq + params.sq_off.ring_mask);
+    aw->sqArray = (unsigned *)(sq + params.sq_off.array);
+    aw->cqHead  = (unsigned *)(cq + params.cq_off.head);
+    aw->cqTail  = (unsigned *)(cq + params.cq_off.tail);
+    aw->cqMask  = (unsigned *)(cq + params.cq_off.ring_mask);
+    aw->cqes    = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    return aw;
+}
+
+// returns a cleared sqe for file index, there is always room as a group fits the ring
+static struct io_uring_sqe *newSqe(asyncWrites_t *aw, int index) {
+    unsigned tail            = *aw->sqTail;
+    unsigned slot            = tail & *aw->sqMask;
+    struct io_uring_sqe *sqe = &aw->sqes[slot];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->user_data    = (uint64_t)index;
+    aw->sqArray[slot] = slot;
+    __atomic_store_n(aw->sqTail, tail + 1, __ATOMIC_RELEASE);
+    aw->queued++;
+    return sqe;
+}
+
+// submits the queued sqes and waits for their completions, calling done for each
+static void runQueued(asyncWrites_t *aw, void (*done)(asyncFile_t *file, int res)) {
+    unsigned pending  = aw->queued;
+    unsigned toSubmit = aw->queued;
+
+    aw->queued = 0;
+    while (pending) {
+        int n = (int)syscall(__NR_io_uring_enter, aw->fd, toSubmit, 1, IORING_ENTER_GETEVENTS,
+                             NULL, 0);
+        if (n < 0 && errno != EINTR) {
+            aw->failed = true;
+            return;
+        }
+        toSubmit -= n > 0 ? (unsigned)n : 0;
+        unsigned head = *aw->cqHead;
+        unsigned tail = __atomic_load_n(aw->cqTail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++, pending--) {
+            struct io_uring_cqe *cqe = &aw->cqes[head & *aw->cqMask];
+            done(&aw->files[cqe->user_data], cqe->res);
+        }
+        __atomic_store_n(aw->cqHead, head, __ATOMIC_RELEASE);
+    }
+}
+
+static void opened(asyncFile_t *file, int res) {
+    if (res < 0) {
+        file->err = " - could not create file";
+    } else {
+        file->fd      = res;
+        file->created = true;
+    }
+}
+
+static void written(asyncFile_t *file, int res) {
+    if (res <= 0) {
+        file->err = " - problem writing file";
+    } else {
+        file->done += res;
+    }
+}
+
+static void closed(asyncFile_t *file, int res) {
+    (void)res;
+    file->fd = -1;
+}
+
+// writes the group of queued files
+// once the ring has failed nothing more is queued and the files left are reported as failed
+static void flushFiles(asyncWrites_t *aw) {
+    bool more;
+
+    for (int i = 0; i < aw->fileCnt && !aw->failed; i++) {
+        struct io_uring_sqe *sqe = newSqe(aw, i);
+        sqe->opcode              = IORING_OP_OPENAT;
+        sqe->fd                  = aw->files[i].dir;
+        sqe->addr                = (uint64_t)(uintptr_t)aw->files[i].name;
+        sqe->open_flags          = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+        sqe->len                 = 0666;
+    }
+    runQueued(aw, opened);
+
+    do { // writes can be short so repeat for any remainder
+        more = false;
+        for (int i = 0; i < aw->fileCnt && !aw->failed; i++) {
+            asyncFile_t *file = &aw->files[i];
+            long left         = outLength(file->content) - file->done;
+            if (!file->err && left > 0) {
+                struct io_uring_sqe *sqe = newSqe(aw, i);
+                sqe->opcode              = IORING_OP_WRITE;
+                sqe->fd                  = file->fd;
+                sqe->addr = (uint64_t)(uintptr_t)(file->content->out.buf + file->done);
+                sqe->len  = (unsigned)(left < MAXWRITE ? left : MAXWRITE);
+                sqe->off  = (uint64_t)file->done;
+                more      = true;
+            }
+        }
+        runQueued(aw, written);
+    } while (more && !aw->failed);
+
+    for (int i = 0; i < aw->fileCnt && !aw->failed; i++) {
+        asyncFile_t *file = &aw->files[i];
+        if (file->fd >= 0) {
+            if (!file->err) { // no io_uring operation for this
+                struct timespec times[2] = { { file->content->out.fdate, 0 },
+                                             { file->content->out.fdate, 0 } };
+                futimens(file->fd, times);
+            }
+            struct io_uring_sqe *sqe = newSqe(aw, i);
+            sqe->opcode              = IORING_OP_CLOSE;
+            sqe->fd                  = file->fd;
+        }
+    }
+    runQueued(aw, closed);
+
+    for (int i = 0; i < aw->fileCnt; i++) {
+        asyncFile_t *file = &aw->files[i];
+        if (file->fd >= 0) { // the ring failed before it was closed
+            close(file->fd);
+        }
+        if (!file->err && file->done < outLength(file->content)) { // the ring failed
+            file->err = file->created ? " - problem writing file" : " - could not create file";
+        }
+        if (file->err) {
+            if (file->created) {
+                removeFile(file->dir, file->name);
+            }
+            aw->ok = false;
+        }
+        saveMsg(file->content, file->err ? file->err : "");
+    }
+    aw->fileCnt = 0;
+}
+
+void asyncWrite(asyncWrites_t *aw, dir_t dir, char const *name, content_t const *content) {
+    if (aw->fileCnt == RINGSIZE) {
+        flushFiles(aw);
+    }
+    aw->files[aw->fileCnt++] = (asyncFile_t){ .dir = dir, .name = name, .content = content, .fd = -1 };
+}
+
+// writes the files queued so far, so that a message about something else comes after theirs
+void flushAsyncWrites(asyncWrites_t *aw) {
+    flushFiles(aw);
+}
+
+void asyncDir(asyncWrites_t *aw, dir_t dir, time_t fdate) {
+    if (aw->dirCnt % 16 == 0) {
+        aw->dirs = xrealloc(aw->dirs, (aw->dirCnt + 16) * sizeof(asyncDir_t));
+    }
+    aw->dirs[aw->dirCnt++] = (asyncDir_t){ dir, fdate };
+}
+
+bool endAsyncWrites(asyncWrites_t *aw) {
+    flushFiles(aw);
+    for (int i = 0; i < aw->dirCnt; i++) { // after their files have been written
+        setDirTime(aw->dirs[i].dir, aw->dirs[i].fdate);
+        closeDir(aw->dirs[i].dir);
+    }
+    xfree(aw->dirs);
+    munmap(aw->sqes, aw->sqesSize);
+    if (aw->cqRingSize) {
+        munmap(aw->cqRing, aw->cqRingSize);
+    }
+    munmap(aw->sqRing, aw->sqRingSize);
+    close(aw->fd);
+    bool ok = aw->ok;
+    xfree(aw);
+    return ok;
+}
+#else
+// no io_uring so the normal write path is always used
+asyncWrites_t *startAsyncWrites() {
+    return NULL;
+}
+
+void asyncWrite(asyncWrites_t *aw, dir_t dir, char const *name, content_t const *content) {
+}
+
+void flushAsyncWrites(asyncWrites_t *aw) {
+}
+
+void asyncDir(asyncWrites_t *aw, dir_t dir, time_t fdate) {
+}
+
+bool endAsyncWrites(asyncWrites_t *aw) {
+    return true;
+}
+#endif
@@ -60,8 +60,12 @@
 #if defined(_WIN32) || defined(__WIN32__) || defined(_MSC_VER) || defined(__MINGW32__)
 /* Win32, DOS, MSVC, MSVS */
 #include <direct.h>
+#include <io.h>
 
 #define MKDIR(DIRNAME) _mkdir(DIRNAME)
+#define DUPFILE(FP)    _dup(_fileno(FP))
+#define CLOSEFD(FD)    _close(FD)
+#define TRUNCATE(FD, SIZE) _chsize_s(FD, (__int64)(SIZE))
 #define STRCLONE(STR)  ((STR) ? _strdup(STR) : NULL)
 #define HAS_DEVICE(P)                                                                              \
     ((((P)[0] >= 'A' && (P)[0] <= 'Z') || ((P)[0] >= 'a' && (P)[0] <= 'z')) && (P)[1] == ':')
@@ -73,9 +77,14 @@
 
 #define MKDIR(DIRNAME) mkdir(DIRNAME, 0755)
 #define STRCLONE(STR)  ((STR) ? strdup(STR) : NULL)
+#define DUPFILE(FP)    dup(fileno(FP))
+#define CLOSEFD(FD)    close(FD)
+#define TRUNCATE(FD, SIZE) ftruncate(FD, (off_t)(SIZE))
 
 #endif
 
+// mz_crc32 uses the faster crc32 implementations in crc.c
+#define MINIZ_EXTERNAL_CRC32 crc32Update
 #include "miniz.h"
 #include "zip.h"
 
@@ -132,14 +141,117 @@ struct zip_entry_t {
     tdefl_compressor comp;
     mz_uint32 external_attr;
     time_t m_time;
+    mz_bool deflated; // data written by zip_entry_write_deflated
+    mz_bool is_dir;   // name ends in /, no data
+    char *comment;
 };
 
 struct zip_t {
     mz_zip_archive archive;
     mz_uint level;
+    mz_uint64 append_ofs; // opened with 'a', the original size restored if the update fails
     struct zip_entry_t entry;
 };
 
+static mz_uint64 zip_read_le64(const mz_uint8 *p) {
+    return MZ_READ_LE32(p) | ((mz_uint64)MZ_READ_LE32(p + 4) << 32);
+}
+
+static mz_bool zip_read_at(MZ_FILE *fp, mz_uint64 ofs, void *buf, size_t n) {
+    return MZ_FSEEK64(fp, (mz_int64)ofs, SEEK_SET) == 0 && MZ_FREAD(buf, 1, n, fp) == n;
+}
+
+/*
+  Loads the central directory of an existing archive into the writer, so that
+  new entries are written over the old central directory and a complete one is
+  written when the archive is closed.
+*/
+static int zip_load_central_dir(mz_zip_archive *pzip) {
+    MZ_FILE *fp           = pzip->m_pState->m_pFile;
+    mz_uint8 *buf         = NULL;
+    mz_uint64 file_size, eocd_ofs, num_entries, cdir_size, cdir_ofs, ofs;
+    size_t n, i;
+    int status = -1;
+
+    if (MZ_FSEEK64(fp, 0, SEEK_END) != 0 ||
+        (file_size = (mz_uint64)MZ_FTELL64(fp)) < MZ_ZIP_END_OF_CENTRAL_DIR_HEADER_SIZE) {
+        return -1;
+    }
+    // the end of central directory record is followed by a comment of up to 64k
+    n = (size_t)MZ_MIN(file_size, MZ_ZIP_END_OF_CENTRAL_DIR_HEADER_SIZE + 0xFFFF);
+    if (!(buf = (mz_uint8 *)MZ_MALLOC(n)) || !zip_read_at(fp, file_size - n, buf, n)) {
+        goto cleanup;
+    }
+    for (i = n - MZ_ZIP_END_OF_CENTRAL_DIR_HEADER_SIZE;
+         MZ_READ_LE32(buf + i) != MZ_ZIP_END_OF_CENTRAL_DIR_HEADER_SIG; i--) {
+        if (i == 0) {
+            // Not a zip archive
+            goto cleanup;
+        }
+    }
+    eocd_ofs    = file_size - n + i;
+    num_entries = MZ_READ_LE16(buf + i + MZ_ZIP_ECDH_CDIR_TOTAL_ENTRIES_OFS);
+    cdir_size   = MZ_READ_LE32(buf + i + MZ_ZIP_ECDH_CDIR_SIZE_OFS);
+    cdir_ofs    = MZ_READ_LE32(buf + i + MZ_ZIP_ECDH_CDIR_OFS_OFS);
+
+    if (num_entries == 0xFFFF || cdir_size == 0xFFFFFFFF || cdir_ofs == 0xFFFFFFFF) {
+        mz_uint8 rec[MZ_ZIP64_END_OF_CENTRAL_DIR_HEADER_SIZE];
+        if (eocd_ofs < MZ_ZIP64_END_OF_CENTRAL_DIR_LOCATOR_SIZE ||
+            !zip_read_at(fp, eocd_ofs - MZ_ZIP64_END_OF_CENTRAL_DIR_LOCATOR_SIZE, rec,
+                         MZ_ZIP64_END_OF_CENTRAL_DIR_LOCATOR_SIZE) ||
+            MZ_READ_LE32(rec) != MZ_ZIP64_END_OF_CENTRAL_DIR_LOCATOR_SIG) {
+            goto cleanup;
+        }
+        ofs = zip_read_le64(rec + MZ_ZIP64_ECDL_REL_OFS_TO_ZIP64_ECDR_OFS);
+        if (!zip_read_at(fp, ofs, rec, sizeof(rec)) ||
+            MZ_READ_LE32(rec) != MZ_ZIP64_END_OF_CENTRAL_DIR_HEADER_SIG) {
+            goto cleanup;
+        }
+        eocd_ofs    = ofs;
+        num_entries = zip_read_le64(rec + MZ_ZIP64_ECDH_CDIR_TOTAL_ENTRIES_OFS);
+        cdir_size   = zip_read_le64(rec + MZ_ZIP64_ECDH_CDIR_SIZE_OFS);
+        cdir_ofs    = zip_read_le64(rec + MZ_ZIP64_ECDH_CDIR_OFS_OFS);
+    }
+    if (cdir_ofs + cdir_size > eocd_ofs || cdir_size > 0xFFFFFFFF) {
+        goto cleanup;
+    }
+
+    MZ_FREE(buf);
+    if (!(buf = (mz_uint8 *)MZ_MALLOC((size_t)cdir_size + 1)) ||
+        !zip_read_at(fp, cdir_ofs, buf, (size_t)cdir_size)) {
+        goto cleanup;
+    }
+    for (ofs = 0; ofs < cdir_size; ofs += n) {
+        mz_uint8 *p = buf + ofs;
+        mz_uint32 cdir_entry_ofs = (mz_uint32)pzip->m_pState->m_central_dir.m_size;
+        if (ofs + MZ_ZIP_CENTRAL_DIR_HEADER_SIZE > cdir_size ||
+            MZ_READ_LE32(p) != MZ_ZIP_CENTRAL_DIR_HEADER_SIG) {
+            goto cleanup;
+        }
+        n = MZ_ZIP_CENTRAL_DIR_HEADER_SIZE + MZ_READ_LE16(p + MZ_ZIP_CDH_FILENAME_LEN_OFS) +
+            MZ_READ_LE16(p + MZ_ZIP_CDH_EXTRA_LEN_OFS) +
+            MZ_READ_LE16(p + MZ_ZIP_CDH_COMMENT_LEN_OFS);
+        if (ofs + n > cdir_size ||
+            !mz_zip_array_push_back(pzip, &pzip->m_pState->m_central_dir, p, n) ||
+            !mz_zip_array_push_back(pzip, &pzip->m_pState->m_central_dir_offsets,
+                                    &cdir_entry_ofs, 1)) {
+            goto cleanup;
+        }
+        pzip->m_total_files++;
+    }
+    if (pzip->m_total_files != num_entries) {
+        goto cleanup;
+    }
+    // new entries follow the old end of central directory record, so the old directory
+    // stays valid until the new one has been written
+    pzip->m_archive_size = file_size;
+    status               = 0;
+
+cleanup:
+    MZ_FREE(buf);
+    return status;
+}
+
 struct zip_t *zip_open(const char *zipname, int level, char mode) {
     struct zip_t *zip = NULL;
 
@@ -169,6 +281,22 @@ struct zip_t *zip_open(const char *zipname, int level, char mode) {
         }
         break;
 
+    case 'a':
+        // Append to an existing archive.
+        zip->archive.m_pWrite     = mz_zip_file_write_func;
+        zip->archive.m_pIO_opaque = &(zip->archive);
+        if (!mz_zip_writer_init(&(zip->archive), 0)) {
+            goto cleanup;
+        }
+        if (!(zip->archive.m_pState->m_pFile = MZ_FOPEN(zipname, "r+b")) ||
+            zip_load_central_dir(&(zip->archive)) != 0) {
+            // Cannot read the existing archive
+            mz_zip_writer_end(&(zip->archive));
+            goto cleanup;
+        }
+        zip->append_ofs = zip->archive.m_archive_size;
+        break;
+
     default:
         goto cleanup;
     }
@@ -180,15 +308,41 @@ cleanup:
     return NULL;
 }
 
-void zip_close(struct zip_t *zip) {
+int zip_close(struct zip_t *zip) {
+    int status = 0;
     if (zip) {
+        MZ_FILE *fp = zip->archive.m_pState ? zip->archive.m_pState->m_pFile : NULL;
+        // an update keeps its own handle so it can still be undone after the close
+        int fd      = fp && zip->append_ofs ? DUPFILE(fp) : -1;
+
         // Always finalize, even if adding failed for some reason, so we have a
         // valid central directory.
-        mz_zip_writer_finalize_archive(&(zip->archive));
+        if (!mz_zip_writer_finalize_archive(&(zip->archive))) {
+            status = -1;
+        }
+        // closed here rather than in mz_zip_writer_end, which ignores the result,
+        // as write errors may only show when the last buffer is flushed
+        if (fp) {
+            zip->archive.m_pState->m_pFile = NULL;
+            if (fflush(fp) != 0) {
+                status = -1;
+            }
+            if (fclose(fp) != 0) {
+                status = -1;
+            }
+        }
+        if (fd >= 0) {
+            // an appended update is discarded, leaving the original archive as it was
+            if (status != 0) {
+                (void)TRUNCATE(fd, zip->append_ofs);
+            }
+            CLOSEFD(fd);
+        }
 
         mz_zip_writer_end(&(zip->archive));
         CLEANUP(zip);
     }
+    return status;
 }
 
 int zip_entry_open(struct zip_t *zip, const char *entryname) {
@@ -230,15 +384,20 @@ int zip_entry_open(struct zip_t *zip, const char *entryname) {
     zip->entry.offset        = zip->archive.m_archive_size;
     zip->entry.header_offset = zip->archive.m_archive_size;
     memset(zip->entry.header, 0, MZ_ZIP_LOCAL_DIR_HEADER_SIZE * sizeof(mz_uint8));
-    zip->entry.method = 0;
+    zip->entry.method   = 0;
+    zip->entry.deflated = MZ_FALSE;
+    zip->entry.is_dir   = zip->entry.name[entrylen - 1] == '/';
 
     // UNIX or APPLE
 #if MZ_PLATFORM == 3 || MZ_PLATFORM == 19
     // regular file with rw-r--r-- persmissions
-    zip->entry.external_attr = (mz_uint32)(0100644) << 16;
+    zip->entry.external_attr = (mz_uint32)(zip->entry.is_dir ? 040755 : 0100644) << 16;
 #else
     zip->entry.external_attr = 0;
 #endif
+    if (zip->entry.is_dir) {
+        zip->entry.external_attr |= 0x10; // MS-DOS directory
+    }
 
     num_alignment_padding_bytes = mz_zip_writer_compute_padding_needed_for_file_alignment(pzip);
 
@@ -250,11 +409,9 @@ int zip_entry_open(struct zip_t *zip, const char *entryname) {
         // Wrong zip compression level
         goto cleanup;
     }
-    // no zip64 support yet
-    if ((pzip->m_total_files == 0xFFFF) ||
-        ((pzip->m_archive_size + num_alignment_padding_bytes + MZ_ZIP_LOCAL_DIR_HEADER_SIZE +
-          MZ_ZIP_CENTRAL_DIR_HEADER_SIZE + entrylen) > 0xFFFFFFFF)) {
-        // No zip64 support yet
+    // zip64 records are used once there are 0xFFFF entries or offsets pass 4GB
+    if (pzip->m_total_files == 0xFFFFFFFF) {
+        // Too many entries
         goto cleanup;
     }
     if (!mz_zip_writer_write_zeros(pzip, zip->entry.offset,
@@ -277,7 +434,7 @@ int zip_entry_open(struct zip_t *zip, const char *entryname) {
 
     zip->entry.offset += entrylen;
     level = zip->level & 0xF;
-    if (level) {
+    if (level && !zip->entry.is_dir) {
         zip->entry.state.m_pZip                 = pzip;
         zip->entry.state.m_cur_archive_file_ofs = zip->entry.offset;
         zip->entry.state.m_comp_size            = 0;
@@ -319,7 +476,9 @@ int zip_entry_close(struct zip_t *zip, time_t m_time) {
     }
 
     level = zip->level & 0xF;
-    if (level) {
+    if (zip->entry.deflated) {
+        zip->entry.method = MZ_DEFLATED;
+    } else if (level && !zip->entry.is_dir) {
         done = tdefl_compress_buffer(&(zip->entry.comp), "", 0, TDEFL_FINISH);
         if (done != TDEFL_STATUS_DONE && done != TDEFL_STATUS_OKAY) {
             // Cannot flush compressed buffer
@@ -331,9 +490,10 @@ int zip_entry_close(struct zip_t *zip, time_t m_time) {
     }
 
     entrylen = (mz_uint16)strlen(zip->entry.name);
-    // no zip64 support yet
-    if ((zip->entry.comp_size > 0xFFFFFFFF) || (zip->entry.offset > 0xFFFFFFFF)) {
-        // No zip64 support, yet
+    // the local header has no room for a zip64 extended information field, so an
+    // entry's sizes are limited to 4GB, its offset can be larger
+    if ((zip->entry.comp_size >= 0xFFFFFFFF) || (zip->entry.uncomp_size >= 0xFFFFFFFF)) {
+        // No zip64 support for entry sizes
         goto cleanup;
     }
 
@@ -354,7 +514,8 @@ int zip_entry_close(struct zip_t *zip, time_t m_time) {
     }
 
     if (!mz_zip_writer_add_to_central_dir(
-            pzip, zip->entry.name, entrylen, NULL, 0, "", 0, zip->entry.uncomp_size,
+            pzip, zip->entry.name, entrylen, NULL, 0, zip->entry.comment ? zip->entry.comment : "",
+            zip->entry.comment ? (mz_uint16)strlen(zip->entry.comment) : 0, zip->entry.uncomp_size,
             zip->entry.comp_size, zip->entry.uncomp_crc32, zip->entry.method, 0, dos_time, dos_date,
             zip->entry.header_offset, zip->entry.external_attr)) {
         // Cannot write to zip central dir
@@ -369,6 +530,7 @@ cleanup:
     if (zip) {
         zip->entry.m_time = 0;
         CLEANUP(zip->entry.name);
+        CLEANUP(zip->entry.comment);
     }
     return status;
 }
@@ -408,3 +570,154 @@ int zip_entry_write(struct zip_t *zip, const void *buf, size_t bufsize) {
 
     return 0;
 }
+
+int zip_deflate(const void *buf, size_t bufsize, int level, struct zip_deflated_t *out) {
+    return zip_deflate_part(buf, bufsize, 0, bufsize, level, out);
+}
+
+int zip_deflate_part(const void *buf, size_t bufsize, size_t start, size_t end, int level,
+                     struct zip_deflated_t *out) {
+    tdefl_output_buffer outbuf = { 0, 0, NULL, MZ_TRUE };
+    const mz_uint8 *data       = (const mz_uint8 *)buf;
+    size_t dict                = start > TDEFL_LZ_DICT_SIZE ? start - TDEFL_LZ_DICT_SIZE : 0;
+    tdefl_compressor *comp;
+    tdefl_status status;
+
+    memset(out, 0, sizeof(*out));
+    if ((level & 0xF) == 0 || (level & 0xF) > MZ_UBER_COMPRESSION || start > end ||
+        end > bufsize) {
+        return -1;
+    }
+    if (!(comp = (tdefl_compressor *)MZ_MALLOC(sizeof(tdefl_compressor)))) {
+        return -1;
+    }
+    // same sequence as zip_entry_write / zip_entry_close so the output is identical
+    status = tdefl_init(comp, tdefl_output_buffer_putter, &outbuf,
+                        (int)tdefl_create_comp_flags_from_zip_params(level & 0xF, -15,
+                                                                     MZ_DEFAULT_STRATEGY));
+    // prime the dictionary with the preceding data, discarding its output
+    if (status == TDEFL_STATUS_OKAY && start > dict) {
+        status        = tdefl_compress_buffer(comp, data + dict, start - dict, TDEFL_SYNC_FLUSH);
+        outbuf.m_size = 0;
+    }
+    if (status == TDEFL_STATUS_OKAY && end > start) {
+        status = tdefl_compress_buffer(comp, data + start, end - start, TDEFL_NO_FLUSH);
+    }
+    // only the last part finishes the stream, the others end byte aligned
+    if (status == TDEFL_STATUS_OKAY || status == TDEFL_STATUS_DONE) {
+        tdefl_flush flush = end == bufsize ? TDEFL_FINISH : TDEFL_SYNC_FLUSH;
+        status            = tdefl_compress_buffer(comp, "", 0, flush);
+    }
+    MZ_FREE(comp);
+    if (status != TDEFL_STATUS_DONE && status != TDEFL_STATUS_OKAY) {
+        MZ_FREE(outbuf.m_pBuf);
+        return -1;
+    }
+
+    out->buf         = outbuf.m_pBuf;
+    out->size        = outbuf.m_size;
+    out->uncomp_size = end - start;
+    out->crc32       = (unsigned int)mz_crc32(MZ_CRC32_INIT, data + start, end - start);
+    return 0;
+}
+
+int zip_entry_write_deflated(struct zip_t *zip, const struct zip_deflated_t *data) {
+    mz_zip_archive *pzip = NULL;
+
+    if (!zip || !data) {
+        return -1;
+    }
+
+    pzip = &(zip->archive);
+    if (data->size > 0 && pzip->m_pWrite(pzip->m_pIO_opaque, zip->entry.offset, data->buf,
+                                         data->size) != data->size) {
+        // Cannot write buffer
+        return -1;
+    }
+    zip->entry.offset += data->size;
+    zip->entry.comp_size    = data->size;
+    zip->entry.uncomp_size  = data->uncomp_size;
+    zip->entry.uncomp_crc32 = data->crc32;
+    zip->entry.deflated     = MZ_TRUE;
+    return 0;
+}
+
+void zip_deflated_free(struct zip_deflated_t *data) {
+    if (data) {
+        CLEANUP(data->buf);
+        data->size = 0;
+    }
+}
+
+int zip_entry_set_comment(struct zip_t *zip, const char *comment) {
+    if (!zip || !zip->entry.name || !comment || strlen(comment) > 0xFFFF) {
+        return -1;
+    }
+    CLEANUP(zip->entry.comment);
+    return (zip->entry.comment = STRCLONE(comment)) ? 0 : -1;
+}
+
+ssize_t zip_entries_total(struct zip_t *zip) {
+    return zip ? (ssize_t)zip->archive.m_total_files : -1;
+}
+
+static const mz_uint8 *zip_central_dir_entry(struct zip_t *zip, size_t index) {
+    mz_zip_internal_state *pState = zip->archive.m_pState;
+    return &MZ_ZIP_ARRAY_ELEMENT(&pState->m_central_dir, mz_uint8,
+                                 MZ_ZIP_ARRAY_ELEMENT(&pState->m_central_dir_offsets, mz_uint32,
+                                                      index));
+}
+
+static void zip_copy_field(char *dst, size_t dstsize, const mz_uint8 *src, size_t len) {
+    if (dst && dstsize) {
+        len = MZ_MIN(len, dstsize - 1);
+        memcpy(dst, src, len);
+        dst[len] = '\0';
+    }
+}
+
+int zip_entry_info(struct zip_t *zip, size_t index, char *name, size_t namesize, char *comment,
+                   size_t commentsize) {
+    const mz_uint8 *p;
+    mz_uint16 namelen, extralen;
+
+    if (!zip || !zip->archive.m_pState || index >= zip->archive.m_total_files) {
+        return -1;
+    }
+    p        = zip_central_dir_entry(zip, index);
+    namelen  = MZ_READ_LE16(p + MZ_ZIP_CDH_FILENAME_LEN_OFS);
+    extralen = MZ_READ_LE16(p + MZ_ZIP_CDH_EXTRA_LEN_OFS);
+    zip_copy_field(name, namesize, p + MZ_ZIP_CENTRAL_DIR_HEADER_SIZE, namelen);
+    zip_copy_field(comment, commentsize, p + MZ_ZIP_CENTRAL_DIR_HEADER_SIZE + namelen + extralen,
+                   MZ_READ_LE16(p + MZ_ZIP_CDH_COMMENT_LEN_OFS));
+    return 0;
+}
+
+int zip_entries_delete(struct zip_t *zip, const int *remove) {
+    mz_zip_internal_state *pState;
+    mz_uint32 kept = 0;
+    size_t size    = 0;
+
+    if (!zip || !zip->archive.m_pState || !remove || zip->entry.name) {
+        return -1;
+    }
+    pState = zip->archive.m_pState;
+    // records only move down, so the central directory can be compacted in place
+    for (mz_uint32 i = 0; i < zip->archive.m_total_files; i++) {
+        const mz_uint8 *p = zip_central_dir_entry(zip, i);
+        size_t len        = MZ_ZIP_CENTRAL_DIR_HEADER_SIZE +
+                     MZ_READ_LE16(p + MZ_ZIP_CDH_FILENAME_LEN_OFS) +
+                     MZ_READ_LE16(p + MZ_ZIP_CDH_EXTRA_LEN_OFS) +
+                     MZ_READ_LE16(p + MZ_ZIP_CDH_COMMENT_LEN_OFS);
+        if (!remove[i]) {
+            memmove((mz_uint8 *)pState->m_central_dir.m_p + size, p, len);
+            MZ_ZIP_ARRAY_ELEMENT(&pState->m_central_dir_offsets, mz_uint32, kept++) =
+                (mz_uint32)size;
+            size += len;
+        }
+    }
+    mz_zip_array_resize(&zip->archive, &pState->m_central_dir, size, MZ_FALSE);
+    mz_zip_array_resize(&zip->archive, &pState->m_central_dir_offsets, kept, MZ_FALSE);
+    zip->archive.m_total_files = kept;
+    return 0;
+}
@@ -129,8 +129,13 @@ extern struct zip_t *zip_open(const char *zipname, int level, char mode);
  * Closes the zip archive, releases resources - always finalize.
  *
  * @param zip zip archive handler.
+ *
+ * @return the return code - 0 on success, negative number (< 0) if the
+ *         central directory could not be written or the file failed to
+ *         flush or close, in which case an archive opened with 'a' is
+ *         restored to its original content.
  */
-extern void zip_close(struct zip_t *zip);
+extern int zip_close(struct zip_t *zip);
 
 /**
  * Opens an entry by name in the zip archive.
@@ -167,6 +172,119 @@ extern int zip_entry_close(struct zip_t *zip, time_t m_time);
  */
 extern int zip_entry_write(struct zip_t *zip, const void *buf, size_t bufsize);
 
+/**
+ * @struct zip_deflated_t
+ *
+ * An entry's data compressed ahead of time by zip_deflate, allowing entries
+ * to be compressed in parallel and then written in order.
+ */
+struct zip_deflated_t {
+    void *buf;          /* raw deflate stream */
+    size_t size;        /* compressed size */
+    size_t uncomp_size; /* original size */
+    unsigned int crc32; /* crc32 of the original data */
+};
+
+/**
+ * Compresses a buffer independently of any zip archive.
+ * Safe to call from multiple threads.
+ *
+ * @param buf input buffer.
+ * @param bufsize input buffer size (in bytes).
+ * @param level compression level (1-9).
+ * @param out receives the compressed data, release with zip_deflated_free.
+ *
+ * @return the return code - 0 on success, negative number (< 0) on error.
+ */
+extern int zip_deflate(const void *buf, size_t bufsize, int level, struct zip_deflated_t *out);
+
+/**
+ * Compresses part of a buffer as a section of the single deflate stream for
+ * the whole buffer, allowing a large buffer to be compressed in parallel.
+ * The dictionary is primed with up to 32 KB of the data before the part and
+ * all but the last part end with a sync flush, so the results of consecutive
+ * parts can be concatenated. Safe to call from multiple threads.
+ *
+ * @param buf the whole input buffer.
+ * @param bufsize the whole input buffer size (in bytes).
+ * @param start offset of the part.
+ * @param end offset of the end of the part.
+ * @param level compression level (1-9).
+ * @param out receives the compressed part and the crc32 of the part alone,
+ *        release with zip_deflated_free.
+ *
+ * @return the return code - 0 on success, negative number (< 0) on error.
+ */
+extern int zip_deflate_part(const void *buf, size_t bufsize, size_t start, size_t end, int level,
+                            struct zip_deflated_t *out);
+
+/**
+ * Writes data compressed by zip_deflate as the current zip entry's data.
+ * Used instead of zip_entry_write, an archive opened with level 0 can hold
+ * both stored entries and ones written this way.
+ *
+ * @param zip zip archive handler.
+ * @param data the compressed data.
+ *
+ * @return the return code - 0 on success, negative number (< 0) on error.
+ */
+extern int zip_entry_write_deflated(struct zip_t *zip, const struct zip_deflated_t *data);
+
+/**
+ * Releases the buffer of compressed data.
+ *
+ * @param data the compressed data.
+ */
+extern void zip_deflated_free(struct zip_deflated_t *data);
+
+/**
+ * Sets the comment stored in the central directory for the current zip entry.
+ *
+ * @param zip zip archive handler.
+ * @param comment the comment, at most 65535 characters.
+ *
+ * @return the return code - 0 on success, negative number (< 0) on error.
+ */
+extern int zip_entry_set_comment(struct zip_t *zip, const char *comment);
+
+/**
+ * Returns the number of entries in the central directory, including those
+ * already in an archive opened with 'a'.
+ *
+ * @param zip zip archive handler.
+ *
+ * @return the number of entries or negative number (< 0) on error.
+ */
+extern ssize_t zip_entries_total(struct zip_t *zip);
+
+/**
+ * Gets the name and comment of an entry by its index in the central directory.
+ * Both are truncated to fit and are NUL terminated, either buffer may be NULL.
+ *
+ * @param zip zip archive handler.
+ * @param index entry index.
+ * @param name buffer for the entry name.
+ * @param namesize size of the name buffer.
+ * @param comment buffer for the entry comment.
+ * @param commentsize size of the comment buffer.
+ *
+ * @return the return code - 0 on success, negative number (< 0) on error.
+ */
+extern int zip_entry_info(struct zip_t *zip, size_t index, char *name, size_t namesize,
+                          char *comment, size_t commentsize);
+
+/**
+ * Removes entries from the central directory, the indices of the remaining
+ * entries are renumbered. Their data stays in the archive file as unused space.
+ * Must not be called while an entry is open.
+ *
+ * @param zip zip archive handler.
+ * @param remove one flag per entry, set for the entries to remove.
+ *
+ * @return the return code - 0 on success, negative number (< 0) on error.
+ */
+extern int zip_entries_delete(struct zip_t *zip, const int *remove);
+
 /** @} */
 
 #ifdef __cplusplus
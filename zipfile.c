@@ -29,17 +29,57 @@
 #include "zip.h"
 #define ZIP_BEST_COMPRESSION_LEVEL  9
 
-static bool saveZipContent(content_t *content, struct zip_t *zip) {
-    bool ok = true;
-    char const *err;
+/*
+    the entries are written in directory order, however their data is compressed
+    independently, so when lbrThreads > 1 the compression is shared across a set of
+    helper threads, largest first, and the archive is assembled once they are all done
+    an entry larger than two chunks is also split into chunk sized parts, each primed
+    with the 32k before it, that are joined into a single deflate stream
+
+    an entry is stored rather than deflated if it is very small, if a sample of its
+    bytes suggests it is already compressed, or if deflating does not make it smaller
+*/
+#define CHUNKSIZE    0x20000
+#define STOREMAX     64       // entries up to this size are always stored
+#define PROBESIZE    4096     // bytes sampled to estimate an entry's entropy
+#define STOREENTROPY (31 * 64) // 7.75 bits per byte, in 1/256ths of a bit
+
+int zipLevel = ZIP_DEFAULT_COMPRESSION_LEVEL; // -c compression level, 0 stores every entry
+
+typedef struct {
+    content_t *content;
+    char const *zpath;
+    struct zip_deflated_t data;
+    struct zip_deflated_t *parts; // the parts of a split entry, joined into data
+    int nParts;
+    bool deflated;                // data holds the compressed entry, else it is stored
+} entry_t;
+
+typedef struct {
+    entry_t *entry;
+    int part;
+    long size;
+} task_t;
+
+struct _zipEntries {
+    entry_t *entries; // in directory order
+    task_t *tasks;    // largest first
+    int count;
+    int nTasks;
+    int next;         // next task to run
+    monitor_t *monitor;
+    char const *top;  // -Z top level directory and the source file it holds
+    char const *source;
+    struct stat srcInfo;
+    time_t fdate;
+};
+
+// build the list of entries to save, including those of nested libraries
+// if topDir is not NULL the names were made under it and the entries are saved under e->top
+static void collectEntries(content_t *content, zipEntries_t *e, char const *topDir) {
     for (content_t *p = content; p; p = p->next) {
-        switch (p->type) {
-        case Skipped:
-        case Missing:
-            break;
-        case Library:
-            ok = saveZipContent(p->lbrHead, zip) && ok;
-            break;
+        if (p->type == Library) {
+            collectEntries(p->lbrHead, e, topDir);
         }
         if (p->type == Skipped || p->type == Library || p->type == Missing) {
             continue;
@@ -51,53 +91,470 @@ static bool saveZipContent(content_t *content, struct zip_t *zip) {
             *s = '/';
         }
 #endif
-        char const *zpath = strchr(p->savePath, '/');
+        char const *name  = topDir ? p->savePath + strlen(topDir) + 1 : p->savePath;
+        char const *zpath = strchr(name, '/');
         if (zpath) {
             zpath++;
         } else {
-            zpath = p->savePath;
+            zpath = name;
         }
+        if (topDir) {
+            zpath = concat(e->top, zpath, NULL);
+        }
+        if (e->count % 64 == 0) {
+            e->entries = xrealloc(e->entries, (e->count + 64) * sizeof(entry_t));
+        }
+        e->entries[e->count++] = (entry_t){ .content = p, .zpath = zpath };
+    }
+}
 
-        err = "";
-        if (zip_entry_open(zip, zpath) != 0) {
-            err = " - failed to open";
-            ok  = false;
-        } else if (zip_entry_write(zip, p->out.buf, (size_t)p->out.pos) != 0) {
-            err = " - failed to write";
-            zip_entry_close(zip, p->out.fdate);
-            ok = false;
-        } else {
-            if (zip_entry_close(zip, p->out.fdate) != 0) {
-                err = " - failed to close";
-                ok  = false;
+// log2(x) in 1/256ths, linear between powers of 2 which is close enough for the probe
+static unsigned log2Fixed(unsigned x) {
+    unsigned k = 0;
+    while ((x >> k) > 1) {
+        k++;
+    }
+    return (k << 8) + (unsigned)(((uint64_t)x << 8 >> k) - 256);
+}
+
+// returns true if the entry is not worth trying to deflate
+static bool storeEntry(uint8_t const *buf, long len) {
+    unsigned counts[256] = { 0 };
+    unsigned n           = 0;
+    uint64_t sum         = 0;
+
+    if (zipLevel == 0 || len <= STOREMAX) {
+        return true;
+    }
+    // byte frequencies of a sample spread across the entry
+    long step = len > PROBESIZE ? len / PROBESIZE : 1;
+    for (long i = 0; i < len && n < PROBESIZE; i += step, n++) {
+        counts[buf[i]]++;
+    }
+    for (int i = 0; i < 256; i++) {
+        if (counts[i]) {
+            sum += (uint64_t)counts[i] * log2Fixed(counts[i]);
+        }
+    }
+    return log2Fixed(n) - (unsigned)(sum / n) >= STOREENTROPY;
+}
+
+static int cmpTask(void const *a, void const *b) {
+    long sizeA = ((task_t const *)a)->size;
+    long sizeB = ((task_t const *)b)->size;
+    return sizeA < sizeB ? 1 : sizeA > sizeB ? -1 : 0;
+}
+
+static void deflateWorker(void *arg) {
+    zipEntries_t *e = arg;
+    for (;;) {
+        enterMonitor(e->monitor);
+        int index = e->next++;
+        exitMonitor(e->monitor);
+        if (index >= e->nTasks) {
+            break;
+        }
+        entry_t *p   = e->tasks[index].entry;
+        long len     = outLength(p->content);
+        uint8_t *buf = p->content->out.buf;
+        if (p->nParts == 0) {
+            p->deflated = zip_deflate(buf, len, zipLevel, &p->data) == 0;
+            if (p->deflated && p->data.size >= (size_t)len) { // no gain so store
+                zip_deflated_free(&p->data);
+                p->deflated = false;
             }
+        } else {
+            // a failed part is left with a NULL buf, which joinParts checks for
+            long start = (long)e->tasks[index].part * CHUNKSIZE;
+            long end   = start + e->tasks[index].size;
+            zip_deflate_part(buf, len, start, end, zipLevel, &p->parts[e->tasks[index].part]);
         }
-        if (nameCmp(nameOnly(zpath), p->out.fname) != 0) {
-            printf("%s -> %s%s\n", p->out.fname, zpath, err);
-        } else if (*err) {
-            printf("%s%s\n", zpath, err);
+    }
+}
+
+// join the parts of a split entry into a single deflate stream
+static void joinParts(entry_t *p) {
+    size_t size = 0;
+    bool ok     = true;
+    for (int i = 0; i < p->nParts; i++) {
+        ok = ok && p->parts[i].buf;
+        size += p->parts[i].size;
+    }
+    if (ok && size < (size_t)outLength(p->content)) { // else the entry is stored
+        uint8_t *buf = xmalloc(size);
+        uint32_t crc = 0;
+        size         = 0;
+        for (int i = 0; i < p->nParts; i++) {
+            memcpy(buf + size, p->parts[i].buf, p->parts[i].size);
+            size += p->parts[i].size;
+            crc = crc32Combine(crc, p->parts[i].crc32, (long)p->parts[i].uncomp_size);
+        }
+        p->data     = (struct zip_deflated_t){ buf, size, (size_t)outLength(p->content), crc };
+        p->deflated = true;
+    }
+    for (int i = 0; i < p->nParts; i++) {
+        zip_deflated_free(&p->parts[i]);
+    }
+    xfree(p->parts);
+}
+
+// compress the entries that are not to be stored, using helper threads if lbrThreads > 1
+static void deflateEntries(zipEntries_t *e) {
+    int nTasks   = 0;
+    bool *stored = xmalloc(e->count * sizeof(bool));
+    for (int i = 0; i < e->count; i++) {
+        long len  = outLength(e->entries[i].content);
+        stored[i] = storeEntry(e->entries[i].content->out.buf, len);
+        if (stored[i]) {
+            continue;
+        }
+        if (lbrThreads > 1 && len > 2 * CHUNKSIZE) {
+            e->entries[i].nParts = (int)((len + CHUNKSIZE - 1) / CHUNKSIZE);
+            e->entries[i].parts  = xcalloc(e->entries[i].nParts, sizeof(struct zip_deflated_t));
+            nTasks += e->entries[i].nParts;
+        } else {
+            nTasks++;
+        }
+    }
+    if (nTasks == 0) {
+        xfree(stored);
+        return;
+    }
+    e->tasks = xmalloc(nTasks * sizeof(task_t));
+    for (int i = 0; i < e->count; i++) {
+        entry_t *p = &e->entries[i];
+        long len   = outLength(p->content);
+        if (stored[i]) {
+            continue;
+        }
+        if (p->nParts == 0) {
+            e->tasks[e->nTasks++] = (task_t){ p, 0, len };
+        }
+        for (int j = 0; j < p->nParts; j++) {
+            long size             = len - (long)j * CHUNKSIZE;
+            e->tasks[e->nTasks++] = (task_t){ p, j, size < CHUNKSIZE ? size : CHUNKSIZE };
+        }
+    }
+    xfree(stored);
+    qsort(e->tasks, e->nTasks, sizeof(task_t), cmpTask);
+    e->monitor = newMonitor();
+
+    int nHelpers = lbrThreads < e->nTasks ? lbrThreads : e->nTasks;
+    if (nHelpers <= 1) {
+        deflateWorker(e);
+    } else {
+        thread_t **helpers = xmalloc(nHelpers * sizeof(thread_t *));
+        for (int i = 0; i < nHelpers; i++) {
+            helpers[i] = startThread(deflateWorker, e);
+        }
+        for (int i = 0; i < nHelpers; i++) {
+            joinThread(helpers[i]);
+        }
+        xfree(helpers);
+    }
+    freeMonitor(e->monitor);
+    xfree(e->tasks);
+
+    for (int i = 0; i < e->count; i++) {
+        if (e->entries[i].nParts) {
+            joinParts(&e->entries[i]);
+        }
+    }
+}
+
+static bool saveZipEntry(entry_t *entry, struct zip_t *zip) {
+    content_t *p      = entry->content;
+    char const *zpath = entry->zpath;
+    char const *err   = "";
+    bool ok           = true;
+
+    if (zip_entry_open(zip, zpath) != 0) {
+        err = " - failed to open";
+        ok  = false;
+    } else if ((entry->deflated ? zip_entry_write_deflated(zip, &entry->data)
+                                : zip_entry_write(zip, p->out.buf, (size_t)outLength(p))) != 0) {
+        err = " - failed to write";
+        zip_entry_close(zip, p->out.fdate);
+        ok = false;
+    } else {
+        if (zip_entry_close(zip, p->out.fdate) != 0) {
+            err = " - failed to close";
+            ok  = false;
         }
     }
+    if (nameCmp(nameOnly(zpath), p->out.fname) != 0) {
+        msgPrintf("%s -> %s%s\n", p->out.fname, zpath, err);
+    } else if (*err) {
+        msgPrintf("%s%s\n", zpath, err);
+    }
     return ok;
 }
 
-bool saveZip(content_t *content, char const *targetDir, char const *zipfile) {
+// write the entries in directory order and free them
+static bool saveZipEntries(zipEntries_t *e, struct zip_t *zip) {
+    bool ok = true;
+    for (int i = 0; i < e->count; i++) {
+        ok = saveZipEntry(&e->entries[i], zip) && ok;
+        zip_deflated_free(&e->entries[i].data);
+    }
+    xfree(e->entries);
+    return ok;
+}
+
+// compress a file's entries ready to be written by saveZip or, with -Z, by addZip
+// source and topDir are the source file, from zipSourceName, and the directory from
+// zipTopDir, both NULL for saveZip
+zipEntries_t *deflateZip(content_t *content, char const *source, char const *topDir) {
+    zipEntries_t *e = xcalloc(1, sizeof(zipEntries_t));
+    e->fdate        = content->in.fdate;
+    if (topDir) {
+        e->top    = concat(nameOnly(topDir), "/", NULL);
+        e->source = source;
+        // without the source's details -u cannot tell if it is unchanged, so a size
+        // that never matches is recorded and the file is always rebuilt
+        if (stat(source, &e->srcInfo) != 0) {
+            e->srcInfo.st_size  = -1;
+            e->srcInfo.st_mtime = 0;
+        }
+    }
+    collectEntries(content, e, topDir);
+    if (e->count > 0) {
+        deflateEntries(e);
+    }
+    return e;
+}
+
+// memory held by the compressed entries, stored entries are still part of the content
+long zipEntriesSize(zipEntries_t const *entries) {
+    long size = 0;
+    for (int i = 0; i < entries->count; i++) {
+        size += (long)entries->entries[i].data.size;
+    }
+    return size;
+}
+
+// write the entries from deflateZip to their own zip file, the entries are freed
+bool saveZip(zipEntries_t *entries, char const *targetDir, char const *zipfile) {
     bool ok             = true;
     char const *zipPath = concat(targetDir, OSDIRSEP, zipfile, NULL);
+    time_t fdate        = entries->fdate;
 
-    struct zip_t *zip   = zip_open(zipPath, ZIP_DEFAULT_COMPRESSION_LEVEL, 'w');
+    // level 0 as entries are stored unless deflateEntries has compressed them
+    struct zip_t *zip   = zip_open(zipPath, 0, 'w');
     if (zip == NULL) {
-        printf("%s - cannot create zip file\n", zipPath);
+        msgPrintf("%s - cannot create zip file\n", zipPath);
+        for (int i = 0; i < entries->count; i++) {
+            zip_deflated_free(&entries->entries[i].data);
+        }
+        xfree(entries->entries);
+        xfree(entries);
         return false;
     }
-    ok = saveZipContent(content, zip);
-    zip_close(zip);
+    ok = saveZipEntries(entries, zip);
+    xfree(entries);
+    ok = zip_close(zip) == 0 && ok;
 
-    setFileTime(zipPath, content->in.fdate);
+    setFileTime(zipPath, fdate);
 
     if (!ok) {
-        printf("%s - problems processing file, deleting\n", zipPath);
+        msgPrintf("%s - problems processing file, deleting\n", zipPath);
         unlink(zipPath);
     }
     return ok;
 }
+
+/*
+    with -Z the content of every file is added to a single zip file, which stays open
+    for the whole run, with each file's content under its own top level directory
+    deflateZip compresses a file's entries and can run in parallel for different files
+    addZip then writes them, so it has to be called in command line order
+    each top level directory has a directory entry whose comment records the source
+    file's full path, size and modification time. With -u an existing zip file is
+    updated, unchanged files are skipped and the entries of changed files are replaced
+    new entries and the new central directory are added after the old one, so they
+    never overwrite it. If the new directory cannot be written the file is truncated
+    back to the original zip file, and if the update is killed the original can be
+    recovered by truncating to its old size. Replaced entries and the old central
+    directory are left as unused space
+*/
+typedef struct {
+    char *fname; // full path, see zipSourceName
+    char *top;
+    long long size;
+    long long mtime;
+    bool replaced;
+} source_t;
+
+static struct zip_t *sharedZip;
+static char *sharedPath;
+static char *sharedName;     // the zip file name, the namespace for the top level directories
+static source_t *sources;    // sources already in the zip file, sorted by fname
+static int sourceCnt;
+static ssize_t existingCnt; // entries in the zip file when opened
+
+static int cmpSource(void const *a, void const *b) {
+    return nameCmp(((source_t const *)a)->fname, ((source_t const *)b)->fname);
+}
+
+// the name a source is recorded as, its full path so that it is found however it is given
+// resolved once per file, the caller frees it
+char *zipSourceName(char const *fname) {
+    char *path       = realpath(fname, NULL);
+    char const *name = path ? path : fname;
+    char *source     = strcpy(xmalloc(strlen(name) + 1), name);
+    free(path);
+    return source;
+}
+
+static source_t *findSource(char const *fname) {
+    source_t key = { .fname = (char *)fname };
+    return sourceCnt ? bsearch(&key, sources, sourceCnt, sizeof(source_t), cmpSource) : NULL;
+}
+
+// registers the top level directory of an existing entry, so new ones do not reuse it
+static char *registerTop(char const *name) {
+    char const *s = strchr(name, '/');
+    if (!s || s == name) {
+        return NULL;
+    }
+    char *top = xmalloc(strlen(sharedName) + strlen(OSDIRSEP) + (s - name) + 1);
+    sprintf(top, "%s%s%.*s", sharedName, OSDIRSEP, (int)(s - name), name);
+    if (chkClash(top)) {
+        xfree(top);
+        return NULL;
+    }
+    return top;
+}
+
+// load the details of the sources recorded in an existing zip file
+static void loadSources() {
+    char name[1024];
+    char comment[1024];
+
+    existingCnt = zip_entries_total(sharedZip);
+    for (ssize_t i = 0; i < existingCnt; i++) {
+        long long size, mtime;
+        int fnameOffset = 0;
+
+        if (zip_entry_info(sharedZip, i, name, sizeof(name), comment, sizeof(comment)) != 0) {
+            continue;
+        }
+        char *top = registerTop(name);
+        size_t len = strlen(name);
+        if (top && len > 1 && name[len - 1] == '/' && strchr(name, '/') == name + len - 1 &&
+            sscanf(comment, "mlbr %lld %lld %n", &size, &mtime, &fnameOffset) == 2 &&
+            fnameOffset && comment[fnameOffset]) {
+            if (sourceCnt % 64 == 0) {
+                sources = xrealloc(sources, (sourceCnt + 64) * sizeof(source_t));
+            }
+            char *fname           = strcpy(xmalloc(strlen(comment + fnameOffset) + 1),
+                                           comment + fnameOffset);
+            sources[sourceCnt++] =
+                (source_t){ .fname = fname, .top = top, .size = size, .mtime = mtime };
+        } else {
+            xfree(top);
+        }
+    }
+    qsort(sources, sourceCnt, sizeof(source_t), cmpSource);
+}
+
+bool openZip(char const *targetDir, char const *zipfile, bool update) {
+    char const *zipPath = makeFullPath(targetDir, zipfile);
+    struct stat info;
+
+    sharedPath = strcpy(xmalloc(strlen(zipPath) + 1), zipPath); // outlives sFree
+    sharedName = strcpy(xmalloc(strlen(zipfile) + 1), zipfile);
+    if (update && stat(sharedPath, &info) == 0) {
+        if ((sharedZip = zip_open(sharedPath, 0, 'a')) == NULL) {
+            fprintf(stderr, "%s - cannot update zip file\n", sharedPath);
+            return false;
+        }
+        loadSources();
+    } else if ((sharedZip = zip_open(sharedPath, 0, 'w')) == NULL) {
+        fprintf(stderr, "%s - cannot create zip file\n", sharedPath);
+        return false;
+    }
+    return true;
+}
+
+// returns true if source is already in the zip file and has not changed since it was added
+// the original entries of a changed file are removed, even if it no longer saves anything
+bool zipUnchanged(char const *source) {
+    source_t *src = findSource(source);
+    struct stat info;
+
+    if (!src) {
+        return false;
+    }
+    if (stat(source, &info) == 0 && (long long)info.st_size == src->size &&
+        (long long)info.st_mtime == src->mtime) {
+        return true;
+    }
+    src->replaced = true;
+    return false;
+}
+
+// the top level directory for source's content, a changed file reuses its previous one
+// it is returned under the zip file's name, as the directory its content is named in, so
+// that the names only have to be unique within it
+char const *zipTopDir(char const *source, char const *name) {
+    source_t *src = findSource(source);
+    if (src) {
+        return src->top;
+    }
+    return uniqueName(sharedName, name);
+}
+
+bool addZip(zipEntries_t *entries) {
+    char comment[1024];
+    bool ok = true;
+
+    snprintf(comment, sizeof(comment), "mlbr %lld %lld %s", (long long)entries->srcInfo.st_size,
+             (long long)entries->srcInfo.st_mtime, entries->source);
+    if (zip_entry_open(sharedZip, entries->top) != 0 ||
+        zip_entry_set_comment(sharedZip, comment) != 0 ||
+        zip_entry_close(sharedZip, entries->fdate) != 0) {
+        msgPrintf("%s - failed to add directory\n", entries->top);
+        ok = false;
+    }
+    ok = saveZipEntries(entries, sharedZip) && ok;
+    xfree(entries);
+    return ok;
+}
+
+// returns false if the zip file could not be completed
+bool closeZip() {
+    bool replaced = false;
+    for (int i = 0; i < sourceCnt; i++) {
+        replaced = replaced || sources[i].replaced;
+    }
+    if (replaced) { // remove the original entries of the files that have been replaced
+        char name[1024];
+        int *remove = xcalloc(zip_entries_total(sharedZip), sizeof(int));
+        for (ssize_t i = 0; i < existingCnt; i++) {
+            if (zip_entry_info(sharedZip, i, name, sizeof(name), NULL, 0) == 0) {
+                for (int j = 0; j < sourceCnt; j++) {
+                    char const *top = sources[j].top + strlen(sharedName) + strlen(OSDIRSEP);
+                    size_t len      = strlen(top);
+                    if (sources[j].replaced && strncmp(name, top, len) == 0 && name[len] == '/') {
+                        remove[i] = true;
+                    }
+                }
+            }
+        }
+        zip_entries_delete(sharedZip, remove);
+        xfree(remove);
+    }
+    bool ok = zip_close(sharedZip) == 0;
+    if (!ok) {
+        fprintf(stderr, "%s - problems writing zip file\n", sharedPath);
+    }
+    sharedZip = NULL;
+    for (int i = 0; i < sourceCnt; i++) {
+        xfree(sources[i].fname); // the tops are still registered names
+    }
+    xfree(sources);
+    xfree(sharedName);
+    xfree(sharedPath);
+    return ok;
+}